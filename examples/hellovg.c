@@ -15,7 +15,6 @@ extern  Window win ;
 extern EGLDisplay  egl_display;
 extern EGLContext  egl_context;
 extern EGLSurface  egl_surface;
-extern VGContext   *vg_context;
 
 int width, height;
 VGPaint radialFill;
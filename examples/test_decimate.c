@@ -0,0 +1,112 @@
+// Checks that PolylineDecimated draws the same pixels as Polyline
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "VG/openvg.h"
+#include "VG/vgu.h"
+#include "shapes.h"
+
+#include "shGLESinit.h"
+
+#define WIDTH   640
+#define HEIGHT  480
+#define SAMPLES 50000
+
+// Differing pixels allowed, relative to the pixels Polyline draws: the
+// stroke of points within one pixel column may antialias differently
+#define TOLERANCE 0.02f
+
+static VGfloat x[SAMPLES], y[SAMPLES];
+static VGuint polyline[WIDTH * HEIGHT], decimated[WIDTH * HEIGHT];
+static VGuint background;
+
+static void draw(VGfloat * mt, VGfloat width, int decimate, VGuint * pixels)
+{
+   vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
+   vgLoadIdentity();
+   Background(0, 0, 0);
+   vgReadPixels(&background, sizeof(VGuint), VG_sRGBA_8888, 0, 0, 1, 1);
+   vgLoadMatrix(mt);
+   StrokeWidth(width);
+   Stroke(255, 255, 255, 1);
+   if (decimate)
+      PolylineDecimated(x, y, SAMPLES);
+   else
+      Polyline(x, y, SAMPLES);
+   vgFinish();
+   vgReadPixels(pixels, WIDTH * sizeof(VGuint), VG_sRGBA_8888,
+                0, 0, WIDTH, HEIGHT);
+}
+
+// compare returns 0 if both drawings match within TOLERANCE. The stroke
+// width is in user units, keep it at least a pixel wide after mt
+static int compare(const char *name, VGfloat * mt, VGfloat width)
+{
+   int lit = 0, diff = 0;
+
+   draw(mt, width, 0, polyline);
+   draw(mt, width, 1, decimated);
+   for (int i = 0; i < WIDTH * HEIGHT; i++) {
+      if (polyline[i] != background)
+         lit++;
+      if (polyline[i] != decimated[i])
+         diff++;
+   }
+
+   printf("%-10s %6d pixels drawn, %5d differ\n", name, lit, diff);
+   return lit == 0 || diff > lit * TOLERANCE;
+}
+
+int main(int argc, char **argv)
+{
+   SHHeadlessConfig cfg;
+   int failed = 0;
+
+   shHeadlessDefaults(&cfg, WIDTH, HEIGHT);
+   if (shGLESinitHeadless(&cfg) != 0) {
+      fprintf(stderr, "No headless GLES context\n");
+      return 1;
+   }
+
+   // A noisy signal far denser than the pixel columns
+   srand(1);
+   for (int i = 0; i < SAMPLES; i++) {
+      x[i] = i * (VGfloat) WIDTH / SAMPLES;
+      y[i] = HEIGHT / 2 + 100 * sinf(i * 0.0005f) +
+             20 * ((VGfloat) rand() / RAND_MAX - 0.5f);
+   }
+
+   // Pixel coordinates to normalized device coordinates
+   VGfloat mt[] = { 2.0f / WIDTH, 0, 0, 0, 2.0f / HEIGHT, 0, -1.0f, -1.0f, 1 };
+   failed |= compare("identity", mt, 1);
+
+   // Zoomed in and shifted by a fraction of a pixel
+   mt[0] *= 3.0f;
+   mt[6] -= 2.0f * 301.37f / WIDTH;
+   failed |= compare("zoomed", mt, 1);
+
+   // Zoomed out
+   mt[0] = 0.5f * 2.0f / WIDTH;
+   mt[6] = -1.0f + 2.0f * 10.25f / WIDTH;
+   failed |= compare("unzoomed", mt, 2);
+
+   // Arrays rewritten in place are decimated again
+   for (int i = 0; i < SAMPLES; i++)
+      y[i] = HEIGHT - y[i];
+   failed |= compare("rewritten", mt, 2);
+
+   // The caller's matrix mode is kept
+   vgSeti(VG_MATRIX_MODE, VG_MATRIX_IMAGE_USER_TO_SURFACE);
+   PolylineDecimated(x, y, SAMPLES);
+   if (vgGeti(VG_MATRIX_MODE) != VG_MATRIX_IMAGE_USER_TO_SURFACE) {
+      printf("matrix mode changed\n");
+      failed = 1;
+   }
+
+   PolylineDecimatedReset();
+   shGLESdeinit();
+
+   printf(failed ? "FAILED\n" : "OK\n");
+   return failed;
+}
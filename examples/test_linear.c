@@ -19,7 +19,6 @@ extern  Window win ;
 extern EGLDisplay  egl_display;
 extern EGLContext  egl_context;
 extern EGLSurface  egl_surface;
-extern VGContext   *vg_context;
 
 VGfloat o[3] = { 0.1f, 0.5f, 1.0f };
 
@@ -33,7 +33,6 @@ extern  Window win ;
 extern EGLDisplay  egl_display;
 extern EGLContext  egl_context;
 extern EGLSurface  egl_surface;
-extern VGContext   *vg_context;
 
 VGfloat tx = -1.0f, ty = -1.0f;     // Translatiom
 VGfloat sx = 2.0/640, sy = (2.0/480) ;  // Scaling
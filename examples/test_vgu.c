@@ -26,7 +26,6 @@ extern  Window win ;
 extern EGLDisplay  egl_display;
 extern EGLContext  egl_context;
 extern EGLSurface  egl_surface;
-extern VGContext   *vg_context;
 
 #define NUM_PRIMITIVES 9
 VGPath primitives[NUM_PRIMITIVES];
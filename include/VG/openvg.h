@@ -621,9 +621,23 @@ VG_API_CALL const VGubyte * vgGetString(VGStringID name);
 #define OVG_SH_blend_src_atop         1
 #define OVG_SH_blend_dst_atop         1
 
+typedef struct VGContext * VGContextSH;
+
 VG_API_CALL VGboolean vgCreateContextSH(VGint width, VGint height);
 VG_API_CALL void vgResizeSurfaceSH(VGint width, VGint height);
 VG_API_CALL void vgDestroyContextSH(void);
+VG_API_CALL VGContextSH vgCreateContextExSH(VGint width, VGint height,
+                                            VGContextSH shareContext);
+VG_API_CALL VGboolean vgMakeCurrentSH(VGContextSH context);
+VG_API_CALL VGContextSH vgGetCurrentContextSH(void);
+VG_API_CALL void vgDestroyContextExSH(VGContextSH context);
+
+/* Ends a frame like vgFlush without flushing GL. vgFlush,
+   vgFinish or vgEndFrameSH must be called before each buffer
+   swap: the stencil is assumed clear until the frame ends */
+VG_API_CALL void vgEndFrameSH(void);
+VG_API_CALL VGuint vgGetFrameHeapAllocsSH(void);
+VG_API_CALL void vgDeferDrawingSH(VGboolean enable);
 
 
 #if defined (__cplusplus)
@@ -12,6 +12,7 @@
 #include <jpeglib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <VG/openvg.h>
 #include <VG/vgu.h>
 #include "DejaVuSans.inc"				   // font data
@@ -27,7 +28,6 @@ extern  Window win ;
 extern EGLDisplay  egl_display;
 extern EGLContext  egl_context;
 extern EGLSurface  egl_surface;
-extern VGContext   *vg_context;
 
 static const int MAXFONTPATH = 500;
 
@@ -241,6 +241,7 @@ void Fontinit(void) {
 
 // finish cleans up
 void Fontdeinit() {
+	PolylineDecimatedReset();
 	unloadfont(SansTypeface.Glyphs, SansTypeface.Count);
 	unloadfont(SerifTypeface.Glyphs, SerifTypeface.Count);
 	unloadfont(MonoTypeface.Glyphs, MonoTypeface.Count);
@@ -289,7 +290,7 @@ typedef enum {
 	PAINT_OBJECT_RG = 3,
 } PaintObjectID;
 
-static VGPaint _paintObjects[4] = { 0, 0, 0, 0 };
+static SH_THREAD_LOCAL VGPaint _paintObjects[4] = { 0, 0, 0, 0 };
 
 static VGPaint getPaintObject(PaintObjectID id, int type) {
 	if (_paintObjects[id] == 0) {
@@ -584,12 +585,34 @@ void interleave(VGfloat * x, VGfloat * y, int n, VGfloat * points) {
 	}
 }
 
+// polypath makes an open path through the points in x, y arrays. Points are
+// appended in batches from a fixed buffer, so large n doesn't grow the stack
+#define POLY_BATCH 256
+static VGPath polypath(const VGfloat * x, const VGfloat * y, VGint n) {
+	VGubyte segments[POLY_BATCH];
+	VGfloat points[POLY_BATCH * 2];
+	VGPath path;
+	VGint i, m;
+
+	path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F, 1.0f, 0.0f, n, n * 2, VG_PATH_CAPABILITY_ALL);
+	memset(segments, VG_LINE_TO_ABS, sizeof(segments));
+	for (i = 0; i < n; i += m) {
+		m = n - i < POLY_BATCH ? n - i : POLY_BATCH;
+		segments[0] = i == 0 ? VG_MOVE_TO_ABS : VG_LINE_TO_ABS;
+		interleave((VGfloat *) x + i, (VGfloat *) y + i, m, points);
+		vgAppendPathData(path, m, segments, points);
+	}
+	return path;
+}
+
 // poly makes either a polygon or polyline
 void poly(VGfloat * x, VGfloat * y, VGint n, VGbitfield flag) {
-	VGfloat points[n * 2];
-	VGPath path = newpath();
-	interleave(x, y, n, points);
-	vguPolygon(path, points, n, VG_FALSE);
+	VGPath path;
+
+	if (n <= 0) {
+		return;
+	}
+	path = polypath(x, y, n);
 	vgDrawPath(path, flag);
 	vgDestroyPath(path);
 }
@@ -604,6 +627,244 @@ void Polyline(VGfloat * x, VGfloat * y, VGint n) {
 	poly(x, y, n, VG_STROKE_PATH);
 }
 
+// Decimated polylines of the last few arrays and zoom levels drawn, with
+// the context owning their paths
+#define DECIMATE_CACHE 4
+typedef struct {
+	const VGfloat *x, *y;
+	VGint n;
+	uint32_t checksum;			   // of the array contents
+	VGfloat scale, offset;			   // pixel columns are floor(x * scale + offset), up to a whole shift
+	VGContextSH context;
+	VGPath path;
+	unsigned int lastUse;
+} Decimated;
+
+static SH_THREAD_LOCAL Decimated _decimated[DECIMATE_CACHE];
+static SH_THREAD_LOCAL unsigned int _decimateClock;
+
+// decimate reduces the points in x, y arrays to the first, lowest, highest
+// and last of each run falling in one pixel column, in their original order,
+// into dx, dy arrays. Returns the number of points kept
+static VGint decimate(const VGfloat * x, const VGfloat * y, VGint n, VGfloat scale, VGfloat offset,
+		      VGfloat * dx, VGfloat * dy) {
+	VGint i, first, lo, hi, k, j, m = 0;
+	VGint keep[4];
+	VGfloat column;
+
+	for (first = 0; first < n; first = i) {
+		column = floorf(x[first] * scale + offset);
+		lo = hi = first;
+		for (i = first + 1; i < n && floorf(x[i] * scale + offset) == column; i++) {
+			if (y[i] < y[lo]) {
+				lo = i;
+			}
+			if (y[i] > y[hi]) {
+				hi = i;
+			}
+		}
+		keep[0] = first;
+		keep[1] = lo < hi ? lo : hi;
+		keep[2] = lo < hi ? hi : lo;
+		keep[3] = i - 1;
+		for (k = 0; k < 4; k++) {
+			if (k > 0 && keep[k] == keep[k - 1]) {
+				continue;
+			}
+			j = keep[k];
+			dx[m] = x[j];
+			dy[m] = y[j];
+			m++;
+		}
+	}
+	return m;
+}
+
+// checksum hashes the bits of the n values in an array, far cheaper than
+// decimating them again
+static uint32_t checksum(const VGfloat * v, VGint n, uint32_t h) {
+	uint32_t bits;
+	VGint i;
+
+	for (i = 0; i < n; i++) {
+		memcpy(&bits, &v[i], sizeof(bits));
+		h = (h ^ bits) * 16777619u;
+	}
+	return h;
+}
+
+// PolylineDecimated makes a polyline through the points in x, y arrays,
+// ordered by x, keeping at most four points per pixel column of the current
+// path transform: the stroke looks the same as Polyline's for large n. The
+// transform maps to normalized device coordinates, so pixel columns are
+// floor((x * mm[0] + mm[6] + 1) * width / 2). The result is cached per
+// arrays, their contents, zoom and subpixel offset, so arrays rewritten in
+// place are decimated again
+void PolylineDecimated(VGfloat * x, VGfloat * y, VGint n) {
+	Decimated *d = &_decimated[0];
+	VGContextSH context = vgGetCurrentContextSH();
+	VGfloat mm[9], scale, offset;
+	VGfloat *dx, *dy;
+	VGint i, m, mode;
+	uint32_t sum;
+
+	if (n <= 0 || context == NULL) {
+		return;
+	}
+	mode = vgGeti(VG_MATRIX_MODE);
+	vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
+	vgGetMatrix(mm);
+	vgSeti(VG_MATRIX_MODE, mode);
+	scale = mm[0] * context->surfaceWidth / 2.0f;
+	offset = (mm[6] + 1.0f) * context->surfaceWidth / 2.0f;
+	offset -= floorf(offset);
+	sum = checksum(y, n, checksum(x, n, 2166136261u));
+
+	// Look for this zoom, else replace the least recently drawn entry
+	for (i = 0; i < DECIMATE_CACHE; i++) {
+		Decimated *e = &_decimated[i];
+		if (e->path != VG_INVALID_HANDLE && e->context == context &&
+		    e->x == x && e->y == y && e->n == n && e->checksum == sum &&
+		    e->scale == scale && e->offset == offset) {
+			d = e;
+			break;
+		}
+		if (e->lastUse < d->lastUse) {
+			d = e;
+		}
+	}
+
+	if (i == DECIMATE_CACHE) {
+		dx = malloc(n * 2 * sizeof(VGfloat));
+		if (dx == NULL) {
+			return;
+		}
+		dy = dx + n;
+		m = decimate(x, y, n, scale, offset, dx, dy);
+		// Paths of another context went with it
+		if (d->path != VG_INVALID_HANDLE && d->context == context) {
+			vgDestroyPath(d->path);
+		}
+		d->x = x;
+		d->y = y;
+		d->n = n;
+		d->checksum = sum;
+		d->context = context;
+		d->scale = scale;
+		d->offset = offset;
+		d->path = polypath(dx, dy, m);
+		free(dx);
+	}
+	d->lastUse = ++_decimateClock;
+	vgDrawPath(d->path, VG_STROKE_PATH);
+}
+
+// PolylineDecimatedReset drops the cached decimated polylines, destroying
+// the paths of the current context. Fontdeinit calls it
+void PolylineDecimatedReset(void) {
+	VGContextSH context = vgGetCurrentContextSH();
+	int i;
+	for (i = 0; i < DECIMATE_CACHE; i++) {
+		if (_decimated[i].path != VG_INVALID_HANDLE && _decimated[i].context == context) {
+			vgDestroyPath(_decimated[i].path);
+		}
+	}
+	memset(_decimated, 0, sizeof(_decimated));
+}
+
+//
+// Stripline functions
+//
+
+// StriplineInit makes a scrolling polyline showing the last n samples,
+// dx apart. The stroke is split over STRIPLINE_PATHS paths of chunk
+// samples each, reused in turn: a sample is appended to the newest one,
+// which only strokes the new segment, and scrolling is a translation.
+Stripline StriplineInit(VGint n, VGfloat dx) {
+	Stripline s;
+	int i;
+
+	memset(&s, 0, sizeof(s));
+	if (n < 1) {
+		n = 1;
+	}
+	s.capacity = n;
+	s.chunk = (n + STRIPLINE_PATHS - 2) / (STRIPLINE_PATHS - 1);
+	s.dx = dx;
+	s.samples = calloc(n, sizeof(VGfloat));
+	for (i = 0; i < STRIPLINE_PATHS; i++) {
+		s.paths[i] = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F, 1.0f, 0.0f,
+					  s.chunk + 1, (s.chunk + 1) * 2, VG_PATH_CAPABILITY_ALL);
+	}
+	return s;
+}
+
+// StriplineFree releases a stripline's samples and paths
+void StriplineFree(Stripline * s) {
+	int i;
+	for (i = 0; i < STRIPLINE_PATHS; i++) {
+		vgDestroyPath(s->paths[i]);
+	}
+	free(s->samples);
+	memset(s, 0, sizeof(*s));
+}
+
+// StriplinePush adds a sample at the end of a stripline, dropping the
+// oldest one once it is full. Each path holds its chunk in its own
+// x range, starting with the last sample of the previous chunk
+void StriplinePush(Stripline * s, VGfloat y) {
+	VGint i = (VGint) (s->count % s->chunk);
+	VGPath path = s->paths[(s->count / s->chunk) % STRIPLINE_PATHS];
+	VGubyte segments[2] = { VG_MOVE_TO_ABS, VG_LINE_TO_ABS };
+	VGfloat coords[4];
+
+	if (i == 0) {
+		vgClearPath(path, VG_PATH_CAPABILITY_ALL);
+		if (s->count > 0) {
+			coords[0] = -s->dx;
+			coords[1] = s->samples[(s->count - 1) % s->capacity];
+			coords[2] = 0.0f;
+			coords[3] = y;
+			vgAppendPathData(path, 2, segments, coords);
+		} else {
+			coords[0] = 0.0f;
+			coords[1] = y;
+			vgAppendPathData(path, 1, segments, coords);
+		}
+	} else {
+		coords[0] = i * s->dx;
+		coords[1] = y;
+		vgAppendPathData(path, 1, segments + 1, coords);
+	}
+	s->samples[s->count % s->capacity] = y;
+	s->count++;
+}
+
+// StriplineDraw strokes a stripline with its oldest sample at (x, y).
+// Up to a chunk of older samples lies left of x, use ClipRect to hide it.
+// Chunks are stroked as separate paths, so the stroke is not joined where
+// one ends and the next begins: wide strokes show a notch there, which
+// round caps (VG_STROKE_CAP_STYLE set to VG_CAP_ROUND) hide
+void StriplineDraw(Stripline s, VGfloat x, VGfloat y) {
+	unsigned long first, k;
+	long offset;
+	VGfloat mm[9];
+
+	if (s.count == 0) {
+		return;
+	}
+	first = s.count > (unsigned long)s.capacity ? s.count - s.capacity : 0;
+	vgGetMatrix(mm);
+	for (k = first / s.chunk; k <= (s.count - 1) / s.chunk; k++) {
+		// Subtract as integers, sample counts go past float precision
+		offset = (long)(k * s.chunk) - (long)first;
+		vgLoadMatrix(mm);
+		vgTranslate(x + (VGfloat) offset * s.dx, y);
+		vgDrawPath(s.paths[k % STRIPLINE_PATHS], VG_STROKE_PATH);
+	}
+	vgLoadMatrix(mm);
+}
+
 // Rect makes a rectangle at the specified location and dimensions
 void Rect_f(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGint FSflag) {
 	VGPath path = newpath();
@@ -674,7 +935,9 @@ void Arc_f(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat sa, VGfloat aext,
 // End checks for errrors and renders to the display
 void Render() {
   assert(vgGetError() == VG_NO_ERROR);
-  eglSwapBuffers ( egl_display, egl_surface );  // buffer to the screen
+  vgEndFrameSH();                               // submit deferred draws, release frame scratch memory
+  if (egl_surface != EGL_NO_SURFACE)            // surfaceless rendering has nothing to swap
+    eglSwapBuffers ( egl_display, egl_surface );  // buffer to the screen
 }
 
 // SaveEnd dumps the raster before rendering to the display 
@@ -690,8 +953,9 @@ void SaveEnd(const char *filename) {
 			fclose(fp);
 		}
 	}
-  eglSwapBuffers ( egl_display, egl_surface );  // buffer to the screen
-
+  vgEndFrameSH();                               // submit deferred draws, release frame scratch memory
+  if (egl_surface != EGL_NO_SURFACE)            // surfaceless rendering has nothing to swap
+    eglSwapBuffers ( egl_display, egl_surface );  // buffer to the screen
 }
 
 // Backgroud clears the screen to a solid background color
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2007 Ivan Leben
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library in the file COPYING;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "shArena.h"
+
+#define SH_ARENA_HEADER \
+   ((sizeof(SHArenaBlock) + SH_ARENA_ALIGN - 1) & ~(size_t) (SH_ARENA_ALIGN - 1))
+
+#define SH_ARENA_DATA(b) ((SHuint8 *) (b) + SH_ARENA_HEADER)
+
+static SHArenaBlock *
+shArenaNewBlock(size_t size)
+{
+   SHArenaBlock *b = (SHArenaBlock *) SH_MALLOC(SH_ARENA_HEADER + size);
+   if (b == NULL)
+      return NULL;
+
+   b->next = NULL;
+   b->size = size;
+   return b;
+}
+
+static void
+shArenaFreeBlocks(SHArena * a)
+{
+   SHArenaBlock *b = a->blocks;
+   while (b != NULL) {
+      SHArenaBlock *next = b->next;
+      free(b);
+      b = next;
+   }
+
+   a->blocks = NULL;
+   a->used = 0;
+}
+
+void
+SHArena_ctor(SHArena * a)
+{
+   SH_ASSERT(a != NULL);
+
+   a->blocks = shArenaNewBlock(SH_ARENA_BLOCK_SIZE);
+   a->used = 0;
+}
+
+void
+SHArena_dtor(SHArena * a)
+{
+   SH_ASSERT(a != NULL);
+   shArenaFreeBlocks(a);
+}
+
+/*--------------------------------------------------------
+ * Returns [size] bytes of scratch memory aligned to
+ * SH_ARENA_ALIGN. When the current block is exhausted a
+ * new one at least twice as big is chained in front.
+ *--------------------------------------------------------*/
+
+void *
+shArenaAlloc(SHArena * a, size_t size)
+{
+   SH_ASSERT(a != NULL);
+
+   size = (size + SH_ARENA_ALIGN - 1) & ~(size_t) (SH_ARENA_ALIGN - 1);
+
+   if (a->blocks == NULL || a->used + size > a->blocks->size) {
+      size_t bsize = (a->blocks ? a->blocks->size * 2 : SH_ARENA_BLOCK_SIZE);
+      while (bsize < size)
+         bsize *= 2;
+
+      SHArenaBlock *b = shArenaNewBlock(bsize);
+      if (b == NULL)
+         return NULL;
+
+      b->next = a->blocks;
+      a->blocks = b;
+      a->used = 0;
+   }
+
+   void *ptr = SH_ARENA_DATA(a->blocks) + a->used;
+   a->used += size;
+   return ptr;
+}
+
+/*--------------------------------------------------------
+ * Releases everything allocated since the last reset. If
+ * the frame needed more than one block they are merged
+ * into a single block big enough for the whole frame, so
+ * in steady state the arena does not touch the heap.
+ *--------------------------------------------------------*/
+
+void
+shArenaReset(SHArena * a)
+{
+   SH_ASSERT(a != NULL);
+
+   if (a->blocks != NULL && a->blocks->next != NULL) {
+      size_t total = 0;
+      for (SHArenaBlock *b = a->blocks; b != NULL; b = b->next)
+         total += b->size;
+
+      shArenaFreeBlocks(a);
+      a->blocks = shArenaNewBlock(total);
+   }
+
+   a->used = 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2007 Ivan Leben
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library in the file COPYING;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*------------------------------------------------------------
+ * Per-context frame arena. Scratch memory needed while
+ * serving a single API call is bump-allocated from here and
+ * released all at once when the frame ends (vgFlush, Render).
+ * Memory from the arena must never be kept across frames.
+ *-----------------------------------------------------------*/
+
+#ifndef __SHARENA_H
+#define __SHARENA_H
+
+#include "shDefs.h"
+
+#define SH_ARENA_BLOCK_SIZE  (64 * 1024)
+#define SH_ARENA_ALIGN       16
+
+typedef struct SHArenaBlock
+{
+   struct SHArenaBlock *next;
+   size_t size;
+
+} SHArenaBlock;
+
+typedef struct
+{
+   SHArenaBlock *blocks;        /* current block first */
+   size_t used;                 /* bytes used in current block */
+
+} SHArena;
+
+void SHArena_ctor(SHArena * a);
+void SHArena_dtor(SHArena * a);
+
+void *shArenaAlloc(SHArena * a, size_t size);
+void shArenaReset(SHArena * a);
+
+#endif /* __SHARENA_H */
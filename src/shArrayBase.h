@@ -74,7 +74,7 @@ VGErrorCode JN(_ARRAY_T, _ctor) (_ARRAY_T * restrict a)
 #ifdef _ARRAY_DEFINE
 {
    SH_ASSERT(a != NULL);
-   a->items = (_ITEM_T *) malloc(sizeof(_ITEM_T) * 64);
+   a->items = (_ITEM_T *) SH_MALLOC(sizeof(_ITEM_T) * 64);
 
    if (a->items == NULL) {
       a->capacity = 0;
@@ -130,7 +130,7 @@ _INLINE VGErrorCode JN(_FUNC_T, Realloc) (_ARRAY_T * restrict a, SHint newsize)
    if (newsize == a->capacity)
       return VG_NO_ERROR;
 
-   _ITEM_T *newitems = (_ITEM_T *) malloc(newsize * sizeof(_ITEM_T));
+   _ITEM_T *newitems = (_ITEM_T *) SH_MALLOC(newsize * sizeof(_ITEM_T));
 
    if (newitems == NULL) {
       return VG_OUT_OF_MEMORY_ERROR;
@@ -160,7 +160,7 @@ _INLINE VGErrorCode JN(_FUNC_T, Reserve) (_ARRAY_T * restrict a, SHint newsize)
    if (newsize <= a->capacity)
       return VG_NO_ERROR;
 
-   _ITEM_T *newitems = (_ITEM_T *) malloc(newsize * sizeof(_ITEM_T));
+   _ITEM_T *newitems = (_ITEM_T *) SH_MALLOC(newsize * sizeof(_ITEM_T));
 
    if (newitems == NULL) {
       return VG_OUT_OF_MEMORY_ERROR;
@@ -190,7 +190,7 @@ _INLINE VGErrorCode JN(_FUNC_T, ReserveAndCopy) (_ARRAY_T * restrict a, SHint ne
    if (newsize <= a->capacity)
       return VG_NO_ERROR;
 
-   _ITEM_T *newitems = (_ITEM_T *) realloc(a->items, newsize * sizeof(_ITEM_T));
+   _ITEM_T *newitems = (_ITEM_T *) SH_REALLOC(a->items, newsize * sizeof(_ITEM_T));
 
    if (newitems == NULL) {
       return VG_OUT_OF_MEMORY_ERROR;
@@ -48,3 +48,9 @@
 #define _COMPARE_T(x,y) 1
 #define _ARRAY_DEFINE
 #include "shArrayBase.h"
+
+#define _ITEM_T  void*
+#define _ARRAY_T SHPtrArray
+#define _FUNC_T  shPtrArray
+#define _ARRAY_DEFINE
+#include "shArrayBase.h"
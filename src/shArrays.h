@@ -52,4 +52,10 @@
 #define _ARRAY_DECLARE
 #include "shArrayBase.h"
 
+#define _ITEM_T  void*
+#define _ARRAY_T SHPtrArray
+#define _FUNC_T  shPtrArray
+#define _ARRAY_DECLARE
+#include "shArrayBase.h"
+
 #endif
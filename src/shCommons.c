@@ -19,17 +19,191 @@
  */
 
 #include "shCommons.h"
+#include "shContext.h"
+#include <string.h>
 #define inline
 
+/*-----------------------------------------------------------
+ * Streaming vertex buffer. GL objects are created lazily on
+ * first use since the VG context may be created before its
+ * GL context is current.
+ *-----------------------------------------------------------*/
+
+void
+SHStreamBuffer_ctor(SHStreamBuffer * s)
+{
+   s->buffer = 0;
+   s->size = 0;
+   s->offset = 0;
+   s->flushed = 0;
+   s->segment = 0;
+   s->pendingFence = -1;
+   s->staging = NULL;
+   for (SHint i = 0; i < SH_STREAM_SEGMENTS; ++i)
+      s->fences[i] = 0;
+}
+
+void
+SHStreamBuffer_dtor(SHStreamBuffer * s)
+{
+   for (SHint i = 0; i < SH_STREAM_SEGMENTS; ++i)
+      if (s->fences[i])
+         glDeleteSync(s->fences[i]);
+
+   if (s->buffer)
+      glDeleteBuffers(1, &s->buffer);
+   free(s->staging);
+}
+
+static void
+shStreamResize(SHStreamBuffer * s, GLsizeiptr size)
+{
+   for (SHint i = 0; i < SH_STREAM_SEGMENTS; ++i) {
+      if (s->fences[i])
+         glDeleteSync(s->fences[i]);
+      s->fences[i] = 0;
+   }
+
+   if (s->buffer == 0)
+      glGenBuffers(1, &s->buffer);
+
+   /* Fresh storage: the driver keeps the old one alive for
+      draws still in flight */
+   glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+   glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+   /* Without staging memory data is written straight through */
+   SHuint8 *staging = (SHuint8 *) SH_REALLOC(s->staging, size);
+   if (staging == NULL)
+      free(s->staging);
+   s->staging = staging;
+
+   s->size = size;
+   s->offset = 0;
+   s->flushed = 0;
+   s->segment = 0;
+   s->pendingFence = -1;
+}
+
+static void
+shStreamWaitSegment(SHStreamBuffer * s, SHint segment)
+{
+   GLsync fence = s->fences[segment];
+   if (fence == 0)
+      return;
+
+   while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                           1000000) == GL_TIMEOUT_EXPIRED)
+      ;
+
+   glDeleteSync(fence);
+   s->fences[segment] = 0;
+}
+
+GLintptr
+shStreamData(SHStreamBuffer * s, const void *data, GLsizeiptr size)
+{
+   SH_ASSERT(s != NULL && data != NULL && size > 0);
+
+   /* Every allocation must fit in a single segment */
+   if (s->buffer == 0 || size > s->size / SH_STREAM_SEGMENTS) {
+      GLsizeiptr total = SH_STREAM_BUFFER_SIZE;
+      while (size > total / SH_STREAM_SEGMENTS)
+         total *= 2;
+      shStreamResize(s, total);
+   } else {
+      glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+   }
+
+   /* Once everything streamed has been flushed, the draws
+      reading the segment left last have been issued */
+   if (s->pendingFence >= 0 && s->offset == s->flushed) {
+      s->fences[s->pendingFence] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      s->pendingFence = -1;
+   }
+
+   GLsizeiptr segmentSize = s->size / SH_STREAM_SEGMENTS;
+   GLintptr offset = (s->offset + SH_STREAM_ALIGN - 1) & ~(GLintptr) (SH_STREAM_ALIGN - 1);
+
+   if (offset + size > (s->segment + 1) * segmentSize) {
+      /* Upload the segment just filled and move to the next.
+         Its fence waits until the batch using it is drawn; a
+         batch spans at most two segments, so the one left
+         before is fenced now if it still is not */
+      shStreamFlush(s);
+      if (s->pendingFence >= 0)
+         s->fences[s->pendingFence] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      s->pendingFence = s->segment;
+      s->segment = (s->segment + 1) % SH_STREAM_SEGMENTS;
+      shStreamWaitSegment(s, s->segment);
+      offset = s->segment * segmentSize;
+      s->flushed = offset;
+   }
+
+   if (s->staging != NULL) {
+      memcpy(s->staging + offset, data, size);
+   } else {
+      glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+      s->flushed = offset + size;
+   }
+   s->offset = offset + size;
+   return offset;
+}
+
+/*-----------------------------------------------------------
+ * Uploads everything streamed since the last flush with a
+ * single write. Leaves the stream bound to GL_ARRAY_BUFFER.
+ *-----------------------------------------------------------*/
+
+void
+shStreamFlush(SHStreamBuffer * s)
+{
+   SH_ASSERT(s != NULL);
+
+   GLsizeiptr size = s->offset - s->flushed;
+   if (s->buffer == 0 || size <= 0)
+      return;
+
+   glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+   void *dst = glMapBufferRange(GL_ARRAY_BUFFER, s->flushed, size,
+                                GL_MAP_WRITE_BIT |
+                                GL_MAP_INVALIDATE_RANGE_BIT |
+                                GL_MAP_UNSYNCHRONIZED_BIT);
+   if (dst != NULL) {
+      memcpy(dst, s->staging + s->flushed, size);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+   } else {
+      glBufferSubData(GL_ARRAY_BUFFER, s->flushed, size,
+                      s->staging + s->flushed);
+   }
+
+   s->flushed = s->offset;
+}
+
+GLintptr
+shStreamVertices(const void *data, GLsizeiptr size)
+{
+   return shStreamData(&shGetContext()->stream, data, size);
+}
+
+void
+shStreamFlushVertices(void)
+{
+   shStreamFlush(&shGetContext()->stream);
+}
+
 inline void
 shDrawQuads(GLfloat v1x, GLfloat v1y, GLfloat v2x, GLfloat v2y, GLfloat v3x, GLfloat v3y, GLfloat v4x, GLfloat v4y)
 {
       GLfloat corners[] = {v1x, v1y, v2x, v2y, v3x, v3y, v4x, v4y};
+      GLintptr offset = shStreamVertices(corners, sizeof(corners));
+      shStreamFlushVertices();
       glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE,
-                          2*sizeof(GLfloat),&corners);
+                          2*sizeof(GLfloat), (GLvoid *) offset);
 	   glEnableVertexAttribArray(position_loc);
       glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 	   glDisableVertexAttribArray(position_loc);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 }
 
@@ -37,11 +211,14 @@ inline void
 shDrawQuadsInt(GLint v1x, GLint v1y, GLint v2x, GLint v2y, GLint v3x, GLint v3y, GLint v4x, GLint v4y)
 {
       GLint corners[] = {v1x, v1y, v2x, v2y, v3x, v3y, v4x, v4y};
+      GLintptr offset = shStreamVertices(corners, sizeof(corners));
+      shStreamFlushVertices();
       glVertexAttribPointer(position_loc, 2, GL_INT, GL_FALSE,
-                          2*sizeof(GLint),&corners);
+                          2*sizeof(GLint), (GLvoid *) offset);
 	   glEnableVertexAttribArray(position_loc);
       glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 	   glDisableVertexAttribArray(position_loc);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 inline void
@@ -53,10 +230,13 @@ shDrawQuadsArray(GLfloat v[8])
       glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
       glDisableClientState(GL_VERTEX_ARRAY);
 */
+    GLintptr offset = shStreamVertices(v, 8 * sizeof(GLfloat));
+    shStreamFlushVertices();
     glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE,
-                          2*sizeof(GLfloat),&v);
+                          2*sizeof(GLfloat), (GLvoid *) offset);
 	 glEnableVertexAttribArray(position_loc);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 	 glDisableVertexAttribArray(position_loc);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 }
@@ -23,6 +23,51 @@
 
 #include "shDefs.h"
 
+/*-----------------------------------------------------------
+ * Streaming vertex buffer for geometry that changes every
+ * draw. Data is sub-allocated in a ring split into segments;
+ * a fence is placed on a segment once the ring has left it
+ * and the draws reading it are issued, and is waited on
+ * before the ring writes there again, so writes never
+ * stall on the GPU nor need orphaning. Writes are
+ * staged in memory and uploaded together by shStreamFlush.
+ *-----------------------------------------------------------*/
+
+#define SH_STREAM_BUFFER_SIZE  (256 * 1024)
+#define SH_STREAM_SEGMENTS     4
+#define SH_STREAM_ALIGN        16
+
+typedef struct
+{
+   GLuint buffer;
+   GLsizeiptr size;
+   GLintptr offset;
+   GLintptr flushed;
+   SHint segment;
+   SHint pendingFence;
+   GLsync fences[SH_STREAM_SEGMENTS];
+   SHuint8 *staging;
+} SHStreamBuffer;
+
+void SHStreamBuffer_ctor(SHStreamBuffer * s);
+void SHStreamBuffer_dtor(SHStreamBuffer * s);
+
+/*-----------------------------------------------------------
+ * Copies data into the stream and returns its byte offset.
+ * The stream is left bound to GL_ARRAY_BUFFER so the offset
+ * can be passed to glVertexAttribPointer; rebind 0 after
+ * drawing. Data reaches the buffer on shStreamFlush, which
+ * must come before the draws reading it: stream everything
+ * a batch draws, flush once, then draw. A batch must fit in
+ * a segment.
+ * shStreamVertices and shStreamFlushVertices use the
+ * current context.
+ *-----------------------------------------------------------*/
+GLintptr shStreamData(SHStreamBuffer * s, const void *data, GLsizeiptr size);
+void shStreamFlush(SHStreamBuffer * s);
+GLintptr shStreamVertices(const void *data, GLsizeiptr size);
+void shStreamFlushVertices(void);
+
 /*-----------------------------------------------------------
  * Draws a GL_QUADS using glDrawArrays
  *-----------------------------------------------------------*/
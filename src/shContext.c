@@ -25,34 +25,127 @@
 #include <string.h>
 #include <stdio.h>
 
+#define _ITEM_T SHHandleSlot
+#define _ARRAY_T SHHandleSlotArray
+#define _FUNC_T shHandleSlotArray
+#define _COMPARE_T(s1,s2) 0
+#define _ARRAY_DEFINE
+#include "shArrayBase.h"
+
 /*-----------------------------------------------------
  * Simple functions to create a VG context instance
  * on top of an existing OpenGL context.
- * TODO: There is no mechanics yet to asure the OpenGL
- * context exists and to choose which context / window
- * to bind to. 
+ * The current VG context is per thread, so several
+ * threads can each drive their own EGL context and
+ * surface. The caller is responsible for making the
+ * matching EGL context current on the same thread.
+ *-----------------------------------------------------*/
+
+SH_THREAD_LOCAL VGContext *vg_context = NULL;
+SH_THREAD_LOCAL SHuint32 shHeapAllocCount = 0;
+
+/*-----------------------------------------------------
+ * Creates a context without binding it. If
+ * shareContext is given, paths, paints and images
+ * are shared with it; for their GL textures to be
+ * usable the EGL contexts must share too (see the
+ * share_context argument of eglCreateContext).
  *-----------------------------------------------------*/
 
-VGContext *vg_context = NULL;
+VG_API_CALL VGContextSH
+vgCreateContextExSH(VGint width, VGint height, VGContextSH shareContext)
+{
+   VGContext *c;
+
+   SH_NEWOBJ(VGContext, c);
+   if (c == NULL)
+      return NULL;
+
+   if (shareContext) {
+      SHResourceGroup *g = shareContext->resources;
+      pthread_mutex_lock(&g->lock);
+      g->refCount++;
+      g->shared = VG_TRUE;
+      shPtrArrayPushBack(&g->contexts, c);
+      pthread_mutex_unlock(&g->lock);
+      c->resources = g;
+   } else {
+      SH_NEWOBJ(SHResourceGroup, c->resources);
+      if (c->resources == NULL) {
+         SH_DELETEOBJ(VGContext, c);
+         return NULL;
+      }
+      shPtrArrayPushBack(&c->resources->contexts, c);
+   }
+
+   /* init surface info */
+   c->surfaceWidth = width;
+   c->surfaceHeight = height;
+
+   return c;
+}
+
+/*-----------------------------------------------------
+ * Binds a context to the calling thread, or unbinds
+ * the current one if NULL. A context must not be
+ * current on two threads at once.
+ *-----------------------------------------------------*/
+
+VG_API_CALL VGboolean
+vgMakeCurrentSH(VGContextSH context)
+{
+   vg_context = context;
+   if (context == NULL)
+      return VG_TRUE;
+
+   /* heap statistics are counted per thread */
+   context->frameHeapAllocMark = shHeapAllocCount;
+
+   /* setup GL projection */
+   glViewport(0, 0, context->surfaceWidth, context->surfaceHeight);
+
+   return VG_TRUE;
+}
+
+VG_API_CALL VGContextSH
+vgGetCurrentContextSH(void)
+{
+   return vg_context;
+}
+
+/*-----------------------------------------------------
+ * Destroys a context, unbinding it first if it is
+ * current on this thread. Its EGL context should be
+ * current so that GL objects are released from it.
+ *-----------------------------------------------------*/
+
+VG_API_CALL void
+vgDestroyContextExSH(VGContextSH context)
+{
+   if (context == NULL)
+      return;
+
+   if (context == vg_context)
+      vg_context = NULL;
+
+   SH_DELETEOBJ(VGContext, context);
+}
 
 VG_API_CALL VGboolean
 vgCreateContextSH(VGint width, VGint height)
 {
+   VGContext *c;
+
    /* return if already created */
    if (vg_context)
       return VG_TRUE;
 
-   /* create new context */
-   SH_NEWOBJ(VGContext, vg_context);
-   if (vg_context == NULL)
+   /* create new context and bind it to this thread */
+   c = vgCreateContextExSH(width, height, NULL);
+   if (c == NULL)
       return VG_FALSE;
 
-   /* init surface info */
-   vg_context->surfaceWidth = width;
-   vg_context->surfaceHeight = height;
-
-   /* setup GL projection */
-   glViewport(0, 0, width, height);
+   vgMakeCurrentSH(c);
 
 // Done in shaders initilaised in shGLESinit() ;
 /*
@@ -92,8 +185,7 @@ vgDestroyContextSH(void)
       return;
 
    /* delete context object */
-   SH_DELETEOBJ(VGContext, vg_context);
-   vg_context = NULL;
+   vgDestroyContextExSH(vg_context);
 }
 
 VGContext *shGetContext(void)
@@ -172,10 +264,26 @@ VGContext_ctor(VGContext * c)
    /* Error */
    c->error = VG_NO_ERROR;
 
-   /* Resources */
-   SH_INITOBJ(SHPathArray, c->paths);
-   SH_INITOBJ(SHPaintArray, c->paints);
-   SH_INITOBJ(SHImageArray, c->images);
+   /* Resources, attached by vgCreateContextExSH() */
+   c->resources = NULL;
+   SH_INITOBJ(SHPtrArray, c->pathPool);
+   SH_INITOBJ(SHPtrArray, c->paintPool);
+   SH_INITOBJ(SHPtrArray, c->imagePool);
+
+   /* Frame scratch memory */
+   SH_INITOBJ(SHArena, c->frameArena);
+   c->frameHeapAllocMark = shHeapAllocCount;
+   c->frameHeapAllocs = 0;
+
+   /* Transient geometry */
+   SH_INITOBJ(SHStreamBuffer, c->stream);
+
+   /* Stencil contents are unknown until the first clear */
+   c->stencilClear = VG_FALSE;
+
+   /* Deferred drawing */
+   c->deferred = VG_FALSE;
+   SH_INITOBJ(SHDrawCommandArray, c->commands);
 
 //   shLoadExtensions(c);
 }
@@ -193,15 +301,231 @@ VGContext_dtor(VGContext * c)
    SH_DEINITOBJ(SHRectArray, c->scissor);
    SH_DEINITOBJ(SHFloatArray, c->strokeDashPattern);
 
-   /* Destroy resources */
-   for (SHint i = 0; i < c->paths.size; ++i)
-      SH_DELETEOBJ(SHPath, c->paths.items[i]);
+   /* Destroy resources once the last context sharing them is gone */
+   if (c->resources) {
+      SHResourceGroup *g = c->resources;
+      SHint refs;
+
+      pthread_mutex_lock(&g->lock);
+      refs = --g->refCount;
+      for (SHint i = 0; i < g->contexts.size; ++i) {
+         if (g->contexts.items[i] == c) {
+            shPtrArrayRemoveAt(&g->contexts, i);
+            break;
+         }
+      }
+      pthread_mutex_unlock(&g->lock);
+
+      if (refs == 0)
+         SH_DELETEOBJ(SHResourceGroup, g);
+   }
+
+   /* Destroy recycled objects */
+   for (SHint i = 0; i < c->pathPool.size; ++i)
+      SH_DELETEOBJ(SHPath, (SHPath *) c->pathPool.items[i]);
+
+   for (SHint i = 0; i < c->paintPool.size; ++i)
+      SH_DELETEOBJ(SHPaint, (SHPaint *) c->paintPool.items[i]);
+
+   for (SHint i = 0; i < c->imagePool.size; ++i)
+      SH_DELETEOBJ(SHImage, (SHImage *) c->imagePool.items[i]);
+
+   SH_DEINITOBJ(SHPtrArray, c->pathPool);
+   SH_DEINITOBJ(SHPtrArray, c->paintPool);
+   SH_DEINITOBJ(SHPtrArray, c->imagePool);
+
+   SH_DEINITOBJ(SHArena, c->frameArena);
+   SH_DEINITOBJ(SHStreamBuffer, c->stream);
+   SH_DEINITOBJ(SHDrawCommandArray, c->commands);
+}
+
+/*-----------------------------------------------------
+ * Resource group constructor / destructor
+ *-----------------------------------------------------*/
+
+void
+SHResourceGroup_ctor(SHResourceGroup * g)
+{
+   SH_INITOBJ(SHHandleSlotArray, g->handles);
+   g->handleFreeList = SH_HANDLE_SLOT_NONE;
+   g->refCount = 1;
+   g->shared = VG_FALSE;
+   SH_INITOBJ(SHPtrArray, g->contexts);
+
+   /* API calls holding the lock call into each other */
+   pthread_mutexattr_t attr;
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+   pthread_mutex_init(&g->lock, &attr);
+   pthread_mutexattr_destroy(&attr);
+}
+
+void
+SHResourceGroup_dtor(SHResourceGroup * g)
+{
+   for (SHint i = 0; i < g->handles.size; ++i) {
+      SHHandleSlot *s = &g->handles.items[i];
+      switch (s->type) {
+      case SH_RESOURCE_PATH:
+         SH_DELETEOBJ(SHPath, (SHPath *) s->object);
+         break;
+      case SH_RESOURCE_PAINT:
+         SH_DELETEOBJ(SHPaint, (SHPaint *) s->object);
+         break;
+      case SH_RESOURCE_IMAGE:
+         SH_DELETEOBJ(SHImage, (SHImage *) s->object);
+         break;
+      default:
+         break;
+      }
+   }
+
+   SH_DEINITOBJ(SHHandleSlotArray, g->handles);
+   SH_DEINITOBJ(SHPtrArray, g->contexts);
+   pthread_mutex_destroy(&g->lock);
+}
+
+/*--------------------------------------------------
+ * Takes the lock of a shared group for the length
+ * of an API call, see VG_GETCONTEXT. Returns the
+ * group to unlock, NULL if it wasn't locked.
+ *--------------------------------------------------*/
+
+SHResourceGroup *
+shLockCall(VGContext * c)
+{
+   SHResourceGroup *g = c->resources;
+   if (!g->shared)
+      return NULL;
+   pthread_mutex_lock(&g->lock);
+   return g;
+}
+
+void
+shUnlockCall(SHResourceGroup * g)
+{
+   if (g != NULL)
+      pthread_mutex_unlock(&g->lock);
+}
+
+/* Only groups shared between contexts pay for locking */
+#define SH_LOCK_RESOURCES(g)   { if ((g)->shared) pthread_mutex_lock(&(g)->lock); }
+#define SH_UNLOCK_RESOURCES(g) { if ((g)->shared) pthread_mutex_unlock(&(g)->lock); }
+
+/*--------------------------------------------------
+ * Resolves a handle to its live slot or NULL if
+ * the handle is malformed, free or stale. The
+ * caller holds the group lock if it is shared.
+ *--------------------------------------------------*/
+
+static inline SHHandleSlot *
+shGetHandleSlot(SHResourceGroup * g, VGHandle h)
+{
+   SH_ASSERT(g != NULL);
+
+   uintptr_t bits = (uintptr_t) h;
+   SHint index = (SHint) (bits & SH_HANDLE_INDEX_MASK) - 1;
+   if (index < 0 || index >= g->handles.size)
+      return NULL;
+
+   SHHandleSlot *s = &g->handles.items[index];
+   if (s->type == SH_RESOURCE_INVALID ||
+       (uintptr_t) s->generation != (bits >> SH_HANDLE_INDEX_BITS))
+      return NULL;
+
+   return s;
+}
+
+/*--------------------------------------------------
+ * Registers an object in the handle table, reusing
+ * a released slot when available. Returns
+ * VG_INVALID_HANDLE if the table is exhausted.
+ *--------------------------------------------------*/
+
+VGHandle
+shCreateHandle(VGContext * c, void *object, SHResourceType type)
+{
+   SH_ASSERT(c != NULL && object != NULL && type != SH_RESOURCE_INVALID);
+
+   SHResourceGroup *g = c->resources;
+   VGHandle h = VG_INVALID_HANDLE;
+   SHHandleSlot *s;
+   SHint index;
+
+   SH_LOCK_RESOURCES(g);
+
+   index = g->handleFreeList;
+   if (index != SH_HANDLE_SLOT_NONE) {
+      s = &g->handles.items[index];
+      g->handleFreeList = s->nextFree;
+   } else {
+      SHHandleSlot fresh;
+      if (g->handles.size >= (SHint) SH_HANDLE_INDEX_MASK)
+         goto done;
+      fresh.generation = 0;
+      if (shHandleSlotArrayPushBackP(&g->handles, &fresh) != VG_NO_ERROR)
+         goto done;
+      index = g->handles.size - 1;
+      s = &g->handles.items[index];
+   }
+
+   s->object = object;
+   s->type = type;
+   s->nextFree = SH_HANDLE_SLOT_NONE;
+
+   h = (VGHandle) (((uintptr_t) s->generation << SH_HANDLE_INDEX_BITS) |
+                   (uintptr_t) (index + 1));
 
-   for (SHint i = 0; i < c->paints.size; ++i)
-      SH_DELETEOBJ(SHPaint, c->paints.items[i]);
+ done:
+   SH_UNLOCK_RESOURCES(g);
+   return h;
+}
+
+/*--------------------------------------------------
+ * Frees the slot of a valid handle. Slots whose
+ * generation would wrap are retired instead of
+ * recycled so that stale handles never alias.
+ *--------------------------------------------------*/
+
+void
+shReleaseHandle(VGContext * c, VGHandle h)
+{
+   SHResourceGroup *g = c->resources;
+
+   SH_LOCK_RESOURCES(g);
+
+   SHHandleSlot *s = shGetHandleSlot(g, h);
+   SH_ASSERT(s != NULL);
+
+   s->object = NULL;
+   s->type = SH_RESOURCE_INVALID;
+
+   if (s->generation < SH_HANDLE_GENERATION_MAX) {
+      s->generation++;
+      s->nextFree = g->handleFreeList;
+      g->handleFreeList = (SHint) (s - g->handles.items);
+   }
 
-   for (SHint i = 0; i < c->images.size; ++i)
-      SH_DELETEOBJ(SHImage, c->images.items[i]);
+   SH_UNLOCK_RESOURCES(g);
+}
+
+/*--------------------------------------------------
+ * Returns the object behind a handle if it is live
+ * and of the given type, NULL otherwise.
+ *--------------------------------------------------*/
+
+void *
+shGetResource(VGContext * c, VGHandle h, SHResourceType type)
+{
+   SHResourceGroup *g = c->resources;
+   void *object;
+
+   SH_LOCK_RESOURCES(g);
+   SHHandleSlot *s = shGetHandleSlot(g, h);
+   object = (s != NULL && s->type == type) ? s->object : NULL;
+   SH_UNLOCK_RESOURCES(g);
+
+   return object;
 }
 
 /*--------------------------------------------------
@@ -210,23 +534,17 @@ VGContext_dtor(VGContext * c)
 
 inline SHint shIsValidPath(VGContext * c, VGHandle h)
 {
-   SH_ASSERT(c != NULL && h != 0);
-   SHint index = shPathArrayFind(&c->paths, (SHPath *) h);
-   return (index == -1) ? 0 : 1;
+   return shGetResource(c, h, SH_RESOURCE_PATH) != NULL;
 }
 
 inline SHint shIsValidPaint(VGContext * c, VGHandle h)
 {
-   SH_ASSERT(c != NULL);
-   SHint index = shPaintArrayFind(&c->paints, (SHPaint *) h);
-   return (index == -1) ? 0 : 1;
+   return shGetResource(c, h, SH_RESOURCE_PAINT) != NULL;
 }
 
 inline SHint shIsValidImage(VGContext * c, VGHandle h)
 {
-   SH_ASSERT(c != NULL);
-   SHint index = shImageArrayFind(&c->images, (SHImage *) h);
-   return (index == -1) ? 0 : 1;
+   return shGetResource(c, h, SH_RESOURCE_IMAGE) != NULL;
 }
 
 /*--------------------------------------------------
@@ -237,14 +555,15 @@ inline SHint shIsValidImage(VGContext * c, VGHandle h)
 inline SHResourceType
 shGetResourceType(VGContext * c, VGHandle h)
 {
-   if (shIsValidPath(c, h))
-      return SH_RESOURCE_PATH;
-   else if (shIsValidPaint(c, h))
-      return SH_RESOURCE_PAINT;
-   else if (shIsValidImage(c, h))
-      return SH_RESOURCE_IMAGE;
-   else
-      return SH_RESOURCE_INVALID;
+   SHResourceGroup *g = c->resources;
+   SHResourceType type;
+
+   SH_LOCK_RESOURCES(g);
+   SHHandleSlot *s = shGetHandleSlot(g, h);
+   type = (s != NULL) ? s->type : SH_RESOURCE_INVALID;
+   SH_UNLOCK_RESOURCES(g);
+
+   return type;
 }
 
 /*-----------------------------------------------------
@@ -275,11 +594,55 @@ vgGetError(void)
    VG_RETURN(error);
 }
 
+/*-----------------------------------------------------
+ * Ends the current frame: releases the frame arena and
+ * records how many heap allocations the frame made.
+ * Called from vgFlush, vgFinish and vgEndFrameSH.
+ *-----------------------------------------------------*/
+
+void
+shEndFrame(VGContext * c)
+{
+   SH_ASSERT(c != NULL);
+
+   /* Recorded draws may point into the arena */
+   shFlushCommands(c);
+   shArenaReset(&c->frameArena);
+
+   /* The stencil is undefined after the buffer swap */
+   c->stencilClear = VG_FALSE;
+   c->frameHeapAllocs = shHeapAllocCount - c->frameHeapAllocMark;
+   c->frameHeapAllocMark = shHeapAllocCount;
+}
+
+VG_API_CALL void
+vgEndFrameSH(void)
+{
+   VG_GETCONTEXT(VG_NO_RETVAL);
+   shEndFrame(context);
+   VG_RETURN(VG_NO_RETVAL);
+}
+
+/*-----------------------------------------------------
+ * Returns the number of heap allocations made by the
+ * library during the last completed frame. Zero in a
+ * steady state.
+ *-----------------------------------------------------*/
+
+VG_API_CALL VGuint
+vgGetFrameHeapAllocsSH(void)
+{
+   VG_GETCONTEXT(0);
+   VG_RETURN(context->frameHeapAllocs);
+}
+
 VG_API_CALL void
 vgFlush(void)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
    glFlush();
+   shEndFrame(context);
    VG_RETURN(VG_NO_RETVAL);
 }
 
@@ -287,7 +650,9 @@ VG_API_CALL void
 vgFinish(void)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
    glFinish();
+   shEndFrame(context);
    VG_RETURN(VG_NO_RETVAL);
 }
 
@@ -297,6 +662,7 @@ vgMask(VGImage mask, VGMaskOperation operation,
 {
    SH_ASSERT(width > 0 && height > 0);
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    switch (operation) {
    case VG_CLEAR_MASK:
@@ -315,12 +681,15 @@ vgMask(VGImage mask, VGMaskOperation operation,
       break;
 
    }
+
+   VG_RETURN(VG_NO_RETVAL);
 }
 
 VG_API_CALL void
 vgClear(VGint x, VGint y, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Clip to window */
    if (x < 0)
@@ -338,6 +707,9 @@ vgClear(VGint x, VGint y, VGint width, VGint height)
 
       glScissor(x, y, width, height);
       glEnable(GL_SCISSOR_TEST);
+   } else {
+      /* The whole stencil is cleared below */
+      context->stencilClear = VG_TRUE;
    }
 
    /* Clear GL color buffer */
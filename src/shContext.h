@@ -24,9 +24,12 @@
 #include "shDefs.h"
 #include "shVectors.h"
 #include "shArrays.h"
+#include "shArena.h"
 #include "shPath.h"
 #include "shPaint.h"
 #include "shImage.h"
+#include "shCommons.h"
+#include <pthread.h>
 
 /*------------------------------------------------
  * VGContext object
@@ -40,7 +43,99 @@ typedef enum
    SH_RESOURCE_IMAGE = 3
 } SHResourceType;
 
+/*------------------------------------------------
+ * Resource handle table. A handle encodes the
+ * index of its slot (plus one, so it is never
+ * NULL) and the generation of the slot. The
+ * generation is bumped on release so handles of
+ * destroyed objects are rejected in O(1).
+ *------------------------------------------------*/
+
+#define SH_HANDLE_INDEX_BITS      20
+#define SH_HANDLE_INDEX_MASK      ((1u << SH_HANDLE_INDEX_BITS) - 1)
+#define SH_HANDLE_GENERATION_MAX  ((1u << (32 - SH_HANDLE_INDEX_BITS)) - 1)
+#define SH_HANDLE_SLOT_NONE       (-1)
+
+typedef struct
+{
+   void *object;
+   SHuint32 generation;
+   SHResourceType type;
+   SHint nextFree;
+} SHHandleSlot;
+
+#define _ITEM_T SHHandleSlot
+#define _ARRAY_T SHHandleSlotArray
+#define _FUNC_T shHandleSlotArray
+#define _ARRAY_DECLARE
+#include "shArrayBase.h"
+
+/*------------------------------------------------
+ * Resource group: the handle table and the
+ * objects behind it. Each context owns one unless
+ * it was created to share another context's
+ * group, in which case the group is refcounted
+ * and guarded by a recursive mutex, held by every
+ * API call of its contexts. Unshared groups never
+ * take the lock.
+ *------------------------------------------------*/
+
+typedef struct
+{
+   SHHandleSlotArray handles;
+   SHint handleFreeList;
+   SHint refCount;
+   VGboolean shared;
+   pthread_mutex_t lock;
+   SHPtrArray contexts;
+} SHResourceGroup;
+
+void SHResourceGroup_ctor(SHResourceGroup * g);
+void SHResourceGroup_dtor(SHResourceGroup * g);
+
+/*------------------------------------------------
+ * A vgDrawPath recorded in deferred mode, with a
+ * snapshot of the context state the draw reads.
+ *------------------------------------------------*/
+
 typedef struct
+{
+   VGPath path;
+   SHPath *p;
+   VGPaintMode mode;
+
+   SHPaint *fillPaint;
+   SHPaint *strokePaint;
+   SHColor fillColor, strokeColor;
+   VGPaintType fillType, strokeType;
+   SHMatrix3x3 pathTransform;
+   VGFillRule fillRule;
+   VGBlendMode blendMode;
+   VGRenderingQuality renderingQuality;
+   VGboolean scissoring;
+   SHRectangle scissor;
+
+   SHfloat strokeLineWidth;
+   VGCapStyle strokeCapStyle;
+   VGJoinStyle strokeJoinStyle;
+   SHfloat strokeMiterLimit;
+   SHfloat strokeDashPhase;
+   VGboolean strokeDashPhaseReset;
+   SHfloat *strokeDashPattern;
+   SHint strokeDashCount;
+
+   /* Path bounds in user space and after the path transform */
+   SHVector2 min, max;
+   SHVector2 boundsMin, boundsMax;
+} SHDrawCommand;
+
+#define _ITEM_T SHDrawCommand
+#define _ARRAY_T SHDrawCommandArray
+#define _FUNC_T shDrawCommandArray
+#define _ARRAY_DECLARE
+#include "shArrayBase.h"
+
+typedef struct VGContext
 {
    /* Surface info (since no EGL yet) */
    SHint surfaceWidth;
@@ -101,10 +196,29 @@ typedef struct
 
    VGErrorCode error;
 
-   /* Resources */
-   SHPathArray paths;
-   SHPaintArray paints;
-   SHImageArray images;
+   /* Resources, possibly shared with other contexts */
+   SHResourceGroup *resources;
+
+   /* Recycled objects */
+   SHPtrArray pathPool;
+   SHPtrArray paintPool;
+   SHPtrArray imagePool;
+
+   /* Per-frame scratch memory and heap statistics */
+   SHArena frameArena;
+   SHuint32 frameHeapAllocMark;
+   SHuint32 frameHeapAllocs;
+
+   /* Streaming vertex buffer for transient geometry */
+   SHStreamBuffer stream;
+
+   /* Stencil known to be all zero since the frame began.
+      Reset by shEndFrame, which must run before each swap */
+   VGboolean stencilClear;
+
+   /* Draws recorded until the next flush, see vgDeferDrawingSH() */
+   VGboolean deferred;
+   SHDrawCommandArray commands;
 
 //mod removed with shExtensions.c
    /* Pointers to extensions */
@@ -125,27 +239,46 @@ SHint shIsValidPath(VGContext * c, VGHandle h);
 SHint shIsValidPaint(VGContext * c, VGHandle h);
 SHint shIsValidImage(VGContext * c, VGHandle h);
 SHResourceType shGetResourceType(VGContext * c, VGHandle h);
+VGHandle shCreateHandle(VGContext * c, void *object, SHResourceType type);
+void shReleaseHandle(VGContext * c, VGHandle h);
+void *shGetResource(VGContext * c, VGHandle h, SHResourceType type);
+
+#define shGetPath(c, h)  ((SHPath *) shGetResource((c), (h), SH_RESOURCE_PATH))
+#define shGetPaint(c, h) ((SHPaint *) shGetResource((c), (h), SH_RESOURCE_PAINT))
+#define shGetImage(c, h) ((SHImage *) shGetResource((c), (h), SH_RESOURCE_IMAGE))
 VGContext *shGetContext(void);
+void shEndFrame(VGContext * c);
+void shFlushCommands(VGContext * c);
+
+/* Context bound to the calling thread, see vgMakeCurrentSH() */
+extern SH_THREAD_LOCAL VGContext *vg_context;
 
 /*----------------------------------------------------
- * TODO: Add mutex locking/unlocking to these macros
- * to assure sequentiallity in multithreading.
+ * The current context is thread-local: every thread
+ * drives its own context. An API call on a context
+ * sharing its resources holds the group lock until
+ * it returns, so objects it resolved can't be
+ * destroyed from another thread meanwhile.
  *----------------------------------------------------*/
 
+SHResourceGroup *shLockCall(VGContext * c);
+void shUnlockCall(SHResourceGroup * g);
+
 #define VG_NO_RETVAL
 
 #define VG_GETCONTEXT(RETVAL) \
    VGContext *context = shGetContext();       \
-      if (!context) return RETVAL;
+      if (!context) return RETVAL;            \
+   SHResourceGroup *_shLocked = shLockCall(context);
 
 #define VG_RETURN(RETVAL) \
-  { return RETVAL; }
+  { shUnlockCall(_shLocked); return RETVAL; }
 
 #define VG_RETURN_ERR(ERRORCODE, RETVAL) \
-  { shSetError(context,ERRORCODE); return RETVAL; }
+  { shSetError(context,ERRORCODE); shUnlockCall(_shLocked); return RETVAL; }
 
 #define VG_RETURN_ERR_IF(COND, ERRORCODE, RETVAL) \
-   { if ((COND)) {shSetError(context,ERRORCODE); return RETVAL;} }
+   { if ((COND)) {shSetError(context,ERRORCODE); shUnlockCall(_shLocked); return RETVAL;} }
 
 /*-----------------------------------------------------------
  * Same macros but no mutex handling - used by sub-functions
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2007 Ivan Leben
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library in the file COPYING;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*------------------------------------------------------------
+ * The base for path coordinate decoders. According to
+ * appropriate macro definitions, a function converting a
+ * run of path coordinates of one datatype into floats
+ * (applying scale and bias) will be generated.
+ *
+ * This code assumes the following are defined:
+ * _COORD_T: the type of the coordinates in the path data
+ * _FUNC_T: the name of the function
+ *
+ * The loops have no per-coordinate branches so that the
+ * compiler can vectorize them. Identity scale and bias
+ * get a plain conversion loop.
+ *-----------------------------------------------------------*/
+
+#ifndef __SHDECODEBASE_H
+#define __SHDECODEBASE_H
+
+#include "shDefs.h"
+
+#endif
+
+/*--------------------------------------------
+ * The rest is not #ifndef protected to allow
+ * for various coordinate types.
+ *--------------------------------------------*/
+
+static void
+_FUNC_T(const void * restrict data, SHint start, SHint count,
+        SHfloat scale, SHfloat bias, SHfloat * restrict out)
+{
+   const _COORD_T * restrict in = (const _COORD_T *) data + start;
+
+   if (scale == 1.0f && bias == 0.0f) {
+      for (SHint i = 0; i < count; ++i)
+         out[i] = (SHfloat) in[i];
+   } else {
+      for (SHint i = 0; i < count; ++i)
+         out[i] = (SHfloat) in[i] * scale + bias;
+   }
+}
+
+#undef _COORD_T
+#undef _FUNC_T
@@ -54,6 +54,14 @@
 #else
 #  define SH_ALIGN(X) __attribute((aligned(X)))
 #endif
+
+/* Per-thread storage for the current context and its statistics */
+
+#if defined(_MSC_VER)
+#  define SH_THREAD_LOCAL __declspec(thread)
+#else
+#  define SH_THREAD_LOCAL __thread
+#endif
 /* Type definitions */
 
 #if defined(HAVE_CONFIG_H)
@@ -140,10 +148,21 @@ typedef union
 #define SH_CLAMPF(x) ((x) > 1.0f ? 1.0f : (((x) < 0.0f ? 0.0f : (x))))
 #define SH_DIST(a,b,x,y) SH_SQRT((((x) - (a)) * ((x) - (a))) + (((y) - (b)) * ((y) - (b))))
 
-#define SH_NEWOBJ(type,obj) { (obj) = (type *) malloc(sizeof(type)); if ((obj) != NULL) type ## _ctor((obj)); }
+/* Counted heap allocation, sampled per frame by vgGetFrameHeapAllocsSH() */
+extern SH_THREAD_LOCAL SHuint32 shHeapAllocCount;
+#define SH_MALLOC(size) (++shHeapAllocCount, malloc((size)))
+#define SH_REALLOC(ptr,size) (++shHeapAllocCount, realloc((ptr),(size)))
+
+#define SH_NEWOBJ(type,obj) { (obj) = (type *) SH_MALLOC(sizeof(type)); if ((obj) != NULL) type ## _ctor((obj)); }
 #define SH_INITOBJ(type,obj) { type ## _ctor(&(obj)); }
 #define SH_DEINITOBJ(type,obj) { type ## _dtor(&(obj)); }
 #define SH_DELETEOBJ(type,obj) { if ((obj)) type ## _dtor((obj)); free((obj)); }
+
+/* Pooled objects: reuse a recycled object from [pool] if any, and on
+   delete give the object back to the pool through type_recycle() which
+   keeps its internal buffers alive */
+#define SH_NEWPOOLOBJ(type,pool,obj) { if ((pool).size > 0) (obj) = (type *) (pool).items[--(pool).size]; else SH_NEWOBJ(type,obj); }
+#define SH_DELETEPOOLOBJ(type,pool,obj) { if ((obj) && (pool).size < SH_MAX_POOLED_OBJECTS && shPtrArrayPushBack(&(pool), (obj)) == VG_NO_ERROR) type ## _recycle((obj)); else SH_DELETEOBJ(type,obj); }
 #define SH_IS_NOT_ALIGNED(p) (((uintptr_t) (p)) & (sizeof(uintptr_t)-1))
 
 /* Implementation limits */
@@ -157,7 +176,10 @@ typedef union
 #define SH_MAX_COLOR_RAMP_STOPS          256
 
 #define SH_MAX_VERTICES                  999999999
-#define SH_MAX_RECURSE_DEPTH             16
+#define SH_MAX_CURVE_SEGMENTS            32768
+
+#define SH_MAX_POOLED_OBJECTS            256
+#define SH_MAX_POOLED_ITEMS              4096        /* buffer items kept on recycle */
 
 #define SH_GRADIENT_TEX_SIZE             1024
 #define SH_GRADIENT_TEX_COORDSIZE        4096        /* 1024 * RGBA */
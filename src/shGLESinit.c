@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include "shGLESinit.h"
+#include <EGL/eglext.h>
 
 // Shared stuff
 Display    *x_display;
@@ -30,6 +31,10 @@ GLint locm,    // mview
 
 static char windowname[32] = "OpenVG";
 
+// Offscreen framebuffer of the surfaceless backend
+static GLuint headless_fbo = 0;
+static GLuint headless_rb[2] = { 0, 0 };   // colour, depth+stencil
+
 // Shaders
 const char vertex_src[] = {
     "#version 300 es\n"
@@ -166,6 +171,107 @@ GLuint load_shader (const char *shader_source, GLenum type)
    return shader;
 }
 
+// Choose an EGL config with the given surface type and pixel format
+static int choose_config(EGLint surface_type, GLint red, GLint green,
+                         GLint blue, GLint alpha, GLint stencil, GLint depth,
+                         EGLConfig *ecfg)
+{
+   EGLint attr[] = {       // some attributes to set up our egl-interface
+      EGL_BUFFER_SIZE, red + green + blue + alpha,
+      EGL_RED_SIZE, red,
+      EGL_GREEN_SIZE, green,
+      EGL_BLUE_SIZE, blue,
+      EGL_ALPHA_SIZE, alpha,
+      EGL_STENCIL_SIZE, stencil,
+      EGL_DEPTH_SIZE, depth,
+      EGL_SURFACE_TYPE, surface_type,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_NONE
+   };
+ 
+   EGLint     num_config;
+   if ( !eglChooseConfig( egl_display, attr, ecfg, 1, &num_config ) ) {
+      fprintf(stderr,"Failed to choose config eglError: %d\n", eglGetError());
+      return 2;
+   }
+ 
+   if ( num_config != 1 ) {
+      fprintf(stderr,"Multiple configs %d\n",num_config);
+      return 2;
+   }
+
+   return 0;
+}
+
+// Create the GLES 3 context
+static int create_context(EGLConfig ecfg)
+{
+   //// egl-contexts collect all state descriptions needed required for operation
+   EGLint ctxattr[] = {
+      EGL_CONTEXT_CLIENT_VERSION, 3,
+      EGL_NONE
+   };
+   egl_context = eglCreateContext ( egl_display, ecfg, EGL_NO_CONTEXT, ctxattr );
+   if ( egl_context == EGL_NO_CONTEXT ) {
+      fprintf(stderr,"Unable to create EGL context eglError: %d\n", eglGetError()) ;
+      return 2;
+   }
+
+   return 0;
+}
+
+// Compile the shaders and create the VG context, common to all backends
+static int setup_shaders(GLint width, GLint height)
+{
+// /////  the openGL part  ////////////////////////////////////////
+// Load shaders
+   GLuint vertexShader = load_shader (vertex_src , GL_VERTEX_SHADER );
+   GLuint fragmentShader = load_shader (fragment3_src , GL_FRAGMENT_SHADER );
+
+   shaderProgram  = glCreateProgram ();                 // create program object
+   glAttachShader ( shaderProgram, vertexShader );       // and attach both...
+   glAttachShader ( shaderProgram, fragmentShader );    // ... shaders to it
+   glLinkProgram ( shaderProgram );    // link the program
+   glUseProgram  ( shaderProgram );    // and select it for usage
+
+
+//// now get the locations (handle) of the shader variables
+   position_loc  = glGetAttribLocation  ( shaderProgram , "position");
+   texc_loc      = glGetAttribLocation ( shaderProgram , "texcoord");
+   tflag_loc    = glGetUniformLocation ( shaderProgram , "texGenflag");
+   color4_loc    = glGetUniformLocation ( shaderProgram , "color4");
+   texs_loc    = glGetUniformLocation ( shaderProgram , "tex_s");
+   angle_loc   = glGetUniformLocation  ( shaderProgram , "Angle");
+   radius_loc  = glGetUniformLocation  ( shaderProgram , "Radius");
+   centre_loc  = glGetUniformLocation  ( shaderProgram , "Centre");
+
+   fprintf(stderr, "Locs: %d %d %d %d %d\n", position_loc, texc_loc,
+                    color4_loc, tflag_loc, texs_loc) ;
+
+   glDeleteShader ( vertexShader );
+   glDeleteShader ( fragmentShader );
+
+// and initialise. Matrix standard in VG and GL is column order
+   GLfloat migu[16] = {1.0,0,0,0 ,0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0};
+   locm = glGetUniformLocation(shaderProgram, "mview") ;
+   glUniformMatrix4fv(locm, 1, GL_FALSE , (GLfloat *) migu );
+   loct = glGetUniformLocation(shaderProgram, "tview") ;
+   glUniformMatrix4fv(loct, 1, GL_FALSE , (GLfloat *) migu );
+   glUniform1i(tflag_loc, 0) ;
+
+   glUniform4f(color4_loc, 0.0f, 0.0f, 0.0f, 1.0f);
+
+// This sets glViewport(0, 0, width, height); ie full window
+   vgCreateContextSH(width, height);
+
+   // So far so good
+   GLint errno ;
+   errno = glGetError() ;
+//   fprintf(stderr,"GLESinit glerr: 0%x\n", errno) ;
+
+   return errno ;
+}
+
 // Set Window name
 void SetWindowName(char *name)
 {
@@ -268,29 +374,9 @@ int shGLESinit(GLint width, GLint height)
       return 2;
    }
  
-   EGLint attr[] = {       // some attributes to set up our egl-interface
-      EGL_BUFFER_SIZE, 32,
-      EGL_RED_SIZE, 8,
-      EGL_GREEN_SIZE, 8,
-      EGL_BLUE_SIZE, 8,
-      EGL_ALPHA_SIZE, 8,
-      EGL_STENCIL_SIZE, 8,
-      EGL_DEPTH_SIZE, 8,
-      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-      EGL_NONE
-   };
- 
    EGLConfig  ecfg;
-   EGLint     num_config;
-   if ( !eglChooseConfig( egl_display, attr, &ecfg, 1, &num_config ) ) {
-      fprintf(stderr,"Failed to choose config eglError: %d\n", eglGetError());
+   if ( choose_config( EGL_WINDOW_BIT, 8, 8, 8, 8, 8, 8, &ecfg ) )
       return 2;
-   }
- 
-   if ( num_config != 1 ) {
-      fprintf(stderr,"Multiple configs %d\n",num_config);
-      return 2;
-   }
  
    egl_surface = eglCreateWindowSurface ( egl_display, ecfg, win, NULL );
    if ( egl_surface == EGL_NO_SURFACE ) {
@@ -298,16 +384,8 @@ int shGLESinit(GLint width, GLint height)
       return 2;
    }
  
-   //// egl-contexts collect all state descriptions needed required for operation
-   EGLint ctxattr[] = {
-      EGL_CONTEXT_CLIENT_VERSION, 3,
-      EGL_NONE
-   };
-   egl_context = eglCreateContext ( egl_display, ecfg, EGL_NO_CONTEXT, ctxattr );
-   if ( egl_context == EGL_NO_CONTEXT ) {
-      fprintf(stderr,"Unable to create EGL context eglError: %d\n", eglGetError()) ;
+   if ( create_context( ecfg ) )
       return 2;
-   }
  
    //// associate the egl-context with the egl-surface
    eglMakeCurrent( egl_display, egl_surface, egl_surface, egl_context );
@@ -315,64 +393,169 @@ int shGLESinit(GLint width, GLint height)
    eglSurfaceAttrib(egl_display, egl_surface, EGL_SWAP_BEHAVIOR,
                     EGL_BUFFER_PRESERVED) ;
 
-// /////  the openGL part  ////////////////////////////////////////
-// Load shaders
-   GLuint vertexShader = load_shader (vertex_src , GL_VERTEX_SHADER );
-   GLuint fragmentShader = load_shader (fragment3_src , GL_FRAGMENT_SHADER );
-
-   shaderProgram  = glCreateProgram ();                 // create program object
-   glAttachShader ( shaderProgram, vertexShader );       // and attach both...
-   glAttachShader ( shaderProgram, fragmentShader );    // ... shaders to it
-   glLinkProgram ( shaderProgram );    // link the program
-   glUseProgram  ( shaderProgram );    // and select it for usage
+   return setup_shaders(width, height);
+}
 
+// Fill in a headless configuration: RGBA8888 with 8 bit stencil
+void shHeadlessDefaults(SHHeadlessConfig *cfg, GLint width, GLint height)
+{
+   cfg->width = width;
+   cfg->height = height;
+   cfg->red_size = 8;
+   cfg->green_size = 8;
+   cfg->blue_size = 8;
+   cfg->alpha_size = 8;
+   cfg->stencil_size = 8;
+   cfg->depth_size = 8;
+   cfg->mode = SH_HEADLESS_AUTO;
+}
 
-//// now get the locations (handle) of the shader variables
-   position_loc  = glGetAttribLocation  ( shaderProgram , "position");
-   texc_loc      = glGetAttribLocation ( shaderProgram , "texcoord");
-   tflag_loc    = glGetUniformLocation ( shaderProgram , "texGenflag");
-   color4_loc    = glGetUniformLocation ( shaderProgram , "color4");
-   texs_loc    = glGetUniformLocation ( shaderProgram , "tex_s");
-   angle_loc   = glGetUniformLocation  ( shaderProgram , "Angle");
-   radius_loc  = glGetUniformLocation  ( shaderProgram , "Radius");
-   centre_loc  = glGetUniformLocation  ( shaderProgram , "Centre");
+// Open the Mesa surfaceless platform if the EGL client supports it
+static EGLDisplay get_surfaceless_display(void)
+{
+   const char *ext = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+   if ( ext == NULL || strstr( ext, "EGL_MESA_platform_surfaceless" ) == NULL )
+      return EGL_NO_DISPLAY;
 
-   fprintf(stderr, "Locs: %d %d %d %d %d\n", position_loc, texc_loc,
-                    color4_loc, tflag_loc, texs_loc) ;
+   PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+   if ( getPlatformDisplay == NULL )
+      return EGL_NO_DISPLAY;
 
-   glDeleteShader ( vertexShader );
-   glDeleteShader ( fragmentShader );
+   return getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+}
 
-// and initialise. Matrix standard in VG and GL is column order
-   GLfloat migu[16] = {1.0,0,0,0 ,0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0};
-   locm = glGetUniformLocation(shaderProgram, "mview") ;
-   glUniformMatrix4fv(locm, 1, GL_FALSE , (GLfloat *) migu );
-   loct = glGetUniformLocation(shaderProgram, "tview") ;
-   glUniformMatrix4fv(loct, 1, GL_FALSE , (GLfloat *) migu );
-   glUniform1i(tflag_loc, 0) ;
+// Render target of the surfaceless backend
+static int create_framebuffer(const SHHeadlessConfig *cfg)
+{
+   GLenum colour_format = GL_RGBA8;
+   if ( cfg->red_size == 5 && cfg->green_size == 6 && cfg->blue_size == 5 )
+      colour_format = GL_RGB565;
+   else if ( cfg->alpha_size == 0 )
+      colour_format = GL_RGB8;
+
+   // Depth and stencil as the config asks, ES3 only combines them as 24/8
+   GLenum ancillary_format = GL_NONE, ancillary_attachment = GL_NONE;
+   if ( cfg->stencil_size > 0 && cfg->depth_size > 0 ) {
+      ancillary_format = GL_DEPTH24_STENCIL8;
+      ancillary_attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+   } else if ( cfg->stencil_size > 0 ) {
+      ancillary_format = GL_STENCIL_INDEX8;
+      ancillary_attachment = GL_STENCIL_ATTACHMENT;
+   } else if ( cfg->depth_size > 0 ) {
+      ancillary_format = cfg->depth_size > 16 ? GL_DEPTH_COMPONENT24 : GL_DEPTH_COMPONENT16;
+      ancillary_attachment = GL_DEPTH_ATTACHMENT;
+   }
 
-   glUniform4f(color4_loc, 0.0f, 0.0f, 0.0f, 1.0f);
+   glGenRenderbuffers( 2, headless_rb );
+   glBindRenderbuffer( GL_RENDERBUFFER, headless_rb[0] );
+   glRenderbufferStorage( GL_RENDERBUFFER, colour_format, cfg->width, cfg->height );
+   if ( ancillary_format != GL_NONE ) {
+      glBindRenderbuffer( GL_RENDERBUFFER, headless_rb[1] );
+      glRenderbufferStorage( GL_RENDERBUFFER, ancillary_format, cfg->width, cfg->height );
+   }
 
-// This sets glViewport(0, 0, width, height); ie full window
-   vgCreateContextSH(width, height);
+   glGenFramebuffers( 1, &headless_fbo );
+   glBindFramebuffer( GL_FRAMEBUFFER, headless_fbo );
+   glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, headless_rb[0] );
+   if ( ancillary_format != GL_NONE )
+      glFramebufferRenderbuffer( GL_FRAMEBUFFER, ancillary_attachment,
+                                 GL_RENDERBUFFER, headless_rb[1] );
 
-   // So far so good
-   GLint errno ;
-   errno = glGetError() ;
-//   fprintf(stderr,"GLESinit glerr: 0%x\n", errno) ;
+   if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE ) {
+      fprintf(stderr,"Incomplete offscreen framebuffer\n") ;
+      return 2;
+   }
 
-   return errno ;
+   return 0;
 }
 
+// Set up the graphics hardware without a display: either an EGL pbuffer
+// on the default display, or an FBO on the Mesa surfaceless platform
+// (e.g. llvmpipe). Drawing and vgReadPixels() work as with shGLESinit().
+int shGLESinitHeadless(const SHHeadlessConfig *cfg)
+{
+   SHHeadlessMode mode = cfg->mode;
+
+   x_display = NULL;
+   egl_surface = EGL_NO_SURFACE;
+   egl_display = EGL_NO_DISPLAY;
+
+   if ( mode != SH_HEADLESS_PBUFFER ) {
+      egl_display = get_surfaceless_display();
+      if ( egl_display == EGL_NO_DISPLAY && mode == SH_HEADLESS_SURFACELESS ) {
+         fprintf(stderr,"No EGL surfaceless platform\n") ;
+         return 2;
+      }
+      mode = (egl_display == EGL_NO_DISPLAY) ? SH_HEADLESS_PBUFFER : SH_HEADLESS_SURFACELESS;
+   }
+
+   if ( mode == SH_HEADLESS_PBUFFER )
+      egl_display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
 
-// Clean up
+   if ( egl_display == EGL_NO_DISPLAY ) {
+      fprintf(stderr,"No EGL display\n") ;
+      return 2;
+   }
+ 
+   if ( !eglInitialize( egl_display, NULL, NULL ) ) {
+      fprintf(stderr,"Unable to initialize EGL\n") ;
+      return 2;
+   }
+
+   EGLConfig  ecfg;
+   if ( choose_config( mode == SH_HEADLESS_PBUFFER ? EGL_PBUFFER_BIT : 0,
+                       cfg->red_size, cfg->green_size, cfg->blue_size,
+                       cfg->alpha_size, cfg->stencil_size, cfg->depth_size, &ecfg ) )
+      return 2;
+
+   if ( create_context( ecfg ) )
+      return 2;
+
+   if ( mode == SH_HEADLESS_PBUFFER ) {
+      EGLint pbattr[] = {
+         EGL_WIDTH, cfg->width,
+         EGL_HEIGHT, cfg->height,
+         EGL_NONE
+      };
+      egl_surface = eglCreatePbufferSurface( egl_display, ecfg, pbattr );
+      if ( egl_surface == EGL_NO_SURFACE ) {
+         fprintf(stderr,"Unable to create EGL pbuffer eglError:%d\n", eglGetError());
+         return 2;
+      }
+   }
+
+   // surfaceless needs EGL_KHR_surfaceless_context, which Mesa provides
+   if ( !eglMakeCurrent( egl_display, egl_surface, egl_surface, egl_context ) ) {
+      fprintf(stderr,"Unable to make EGL context current eglError:%d\n", eglGetError());
+      return 2;
+   }
+
+   if ( mode == SH_HEADLESS_SURFACELESS && create_framebuffer( cfg ) )
+      return 2;
+
+   return setup_shaders(cfg->width, cfg->height);
+}
+
+// Clean up, for either backend
 void shGLESdeinit(void)
 {
+   if ( headless_fbo ) {
+      glDeleteFramebuffers( 1, &headless_fbo );
+      glDeleteRenderbuffers( 2, headless_rb );
+      headless_fbo = 0;
+   }
+
+   eglMakeCurrent    ( egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
    eglDestroyContext ( egl_display, egl_context );
-   eglDestroySurface ( egl_display, egl_surface );
+   if ( egl_surface != EGL_NO_SURFACE )
+      eglDestroySurface ( egl_display, egl_surface );
    eglTerminate      ( egl_display );
-   XDestroyWindow    ( x_display, win );
-   XCloseDisplay     ( x_display );
 
+   if ( x_display ) {
+      XDestroyWindow    ( x_display, win );
+      XCloseDisplay     ( x_display );
+   }
 }
 
@@ -1,5 +1,8 @@
 // rpi 4 ONLY */
 
+#ifndef __SHGLESINIT_H
+#define __SHGLESINIT_H
+
 #include  <X11/Xlib.h>
 #include  <X11/Xatom.h>
 #include  <X11/Xutil.h>
@@ -12,7 +15,25 @@
 #include <VG/openvg.h>
 #include <VG/vgu.h>
 
+// Offscreen backends of shGLESinitHeadless()
+typedef enum {
+   SH_HEADLESS_AUTO = 0,      // surfaceless if available, else pbuffer
+   SH_HEADLESS_PBUFFER,       // EGL pbuffer on the default display
+   SH_HEADLESS_SURFACELESS    // EGL_MESA_platform_surfaceless + FBO
+} SHHeadlessMode;
+
+typedef struct {
+   GLint width, height;
+   GLint red_size, green_size, blue_size, alpha_size;   // e.g. 8888 or 5650
+   GLint stencil_size, depth_size;
+   SHHeadlessMode mode;
+} SHHeadlessConfig;
+
 int shGLESinit(GLint width, GLint height) ;
+void shHeadlessDefaults(SHHeadlessConfig *cfg, GLint width, GLint height) ;
+int shGLESinitHeadless(const SHHeadlessConfig *cfg) ;
 void shGLESdeinit(void) ;
 
 VG_API_CALL VGboolean vgCreateContextSH(VGint width, VGint height) ;
+
+#endif /* __SHGLESINIT_H */
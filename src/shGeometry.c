@@ -24,358 +24,248 @@
 #include "shGeometry.h"
 #include "shMath.h"
 
+/* State of a flattening pass, passed to the segment callback */
+typedef struct
+{
+   SHint contourStart;
+   SHfloat tolerance;
+   SHfloat length;
+
+} SHFlattenState;
+
 static inline int
-shAddVertex(SHPath * restrict p, SHVertex * restrict v, SHint * restrict contourStart)
+shAddVertex(SHPath * restrict p, SHFlattenState * restrict s,
+            const SHVector2 * restrict point, SHuint8 flags)
 {
-   SH_ASSERT(p != NULL && v != NULL && contourStart != NULL);
+   SH_ASSERT(p != NULL && s != NULL && point != NULL);
    /* Assert contour was open */
-   SH_ASSERT((*contourStart) >= 0);
+   SH_ASSERT(s->contourStart >= 0);
 
    /* Check vertex limit */
    if (p->vertices.size >= SH_MAX_VERTICES)
       return 0;
 
-   /* Add vertex to subdivision */
-   shVertexArrayPushBackP(&p->vertices, v);
+   /* Running arc length and bounds */
+   if (p->vertices.size > s->contourStart) {
+      const SHVector2 *prev = &p->vertices.items[p->vertices.size - 1];
+      SHfloat dx = point->x - prev->x, dy = point->y - prev->y;
+      s->length += SH_SQRT(dx * dx + dy * dy);
+   }
+
+   if (p->vertices.size == 0) {
+      p->min = p->max = *point;
+   } else {
+      p->min.x = SH_MIN(p->min.x, point->x);
+      p->min.y = SH_MIN(p->min.y, point->y);
+      p->max.x = SH_MAX(p->max.x, point->x);
+      p->max.y = SH_MAX(p->max.y, point->y);
+   }
 
-   /* Increment contour size. Its stored in
-      the flags of first contour vertex */
-   p->vertices.items[*contourStart].flags++;
+   /* Add vertex to subdivision and grow the open contour */
+   shVector2ArrayPushBackP(&p->vertices, (SHVector2 *) point);
+   shUint8ArrayPushBack(&p->vertexFlags, flags);
+   p->contours.items[p->contours.size - 1]++;
 
    return 1;
 }
 
-static void
-shSubrecurseQuad(SHPath * restrict p, SHQuad * quad, SHint * restrict contourStart)
-{
-   SHVertex v;
-   SHVector2 mid, dif, c1, c2, c3;
-   SHQuad quads[SH_MAX_RECURSE_DEPTH];
-   SHQuad *q, *qleft, *qright;
-   SHint qindex = 0;
-
-   SH_ASSERT(p != NULL && quad != NULL && contourStart != NULL);
-
-   quads[0] = *quad;
-
-   while (qindex >= 0) {
-
-      q = &quads[qindex];
-
-      /* Calculate distance of control point from its
-         counterpart on the line between end points */
-      SET2V(mid, q->p1);
-      ADD2V(mid, q->p3);
-      DIV2(mid, 2);
-      SET2V(dif, q->p2);
-      SUB2V(dif, mid);
-      ABS2(dif);
-
-      /* Cancel if the curve is flat enough */
-      if (dif.x + dif.y <= SH_PATH_ESTIMATE_QUALITY
-          || qindex == SH_MAX_RECURSE_DEPTH - 1) {
-
-         /* Add subdivision point */
-         v.point = q->p3;
-         v.flags = 0;
-         if (qindex == 0)
-            return;             /* Skip last point */
-         if (!shAddVertex(p, &v, contourStart))
-            return;
-         --qindex;
-
-      } else {
+/*--------------------------------------------------
+ * Curve flattening. The number of segments needed
+ * for a curve to stay within the tolerance of its
+ * chords is computed up front: with Wang's
+ * formula for the Beziers and from the sagitta of the
+ * widest radius for arcs. The points are then stepped
+ * by forward differencing or by rotating the angle
+ * vector, so the loops need no division nor trig. The
+ * end point is not added, the caller adds it.
+ *--------------------------------------------------*/
 
-         /* Left recursion goes on top of stack! */
-         qright = q;
-         qleft = &quads[++qindex];
-
-         /* Subdivide into 2 sub-curves */
-         SET2V(c1, q->p1);
-         ADD2V(c1, q->p2);
-         DIV2(c1, 2);
-         SET2V(c3, q->p2);
-         ADD2V(c3, q->p3);
-         DIV2(c3, 2);
-         SET2V(c2, c1);
-         ADD2V(c2, c3);
-         DIV2(c2, 2);
-
-         /* Add left recursion onto stack */
-         qleft->p1 = q->p1;
-         qleft->p2 = c1;
-         qleft->p3 = c2;
-
-         /* Add right recursion onto stack */
-         qright->p1 = c2;
-         qright->p2 = c3;
-         qright->p3 = q->p3;
-      }
+static SHint
+shReserveCurveVertices(SHPath * restrict p, SHfloat segments)
+{
+   SHint n = (SHint) SH_CEIL(segments);
+   if (n < 1)
+      n = 1;
+   if (n > SH_MAX_CURVE_SEGMENTS)
+      n = SH_MAX_CURVE_SEGMENTS;
+
+   /* Grow geometrically so consecutive curves don't realloc */
+   SHint need = p->vertices.size + n;
+   if (need > p->vertices.capacity) {
+      need = SH_MAX(need, p->vertices.capacity * 2);
+      shVector2ArrayReserveAndCopy(&p->vertices, need);
+      shUint8ArrayReserveAndCopy(&p->vertexFlags, need);
    }
+   return n;
 }
 
 static void
-shSubrecurseCubic(SHPath * restrict p, SHCubic * cubic, SHint * restrict contourStart)
+shSubdivideQuad(SHPath * restrict p, SHQuad * quad,
+                SHFlattenState * restrict s)
 {
-   SHVertex v;
-   SHfloat dx1, dy1, dx2, dy2;
-   SHVector2 mm, c1, c2, c3, c4, c5;
-   SHCubic cubics[SH_MAX_RECURSE_DEPTH];
-   SHCubic *c, *cleft, *cright;
-   SHint cindex = 0;
-
-   SH_ASSERT(p != NULL && cubic != NULL && contourStart != NULL);
-
-   cubics[0] = *cubic;
-
-   while (cindex >= 0) {
-
-      c = &cubics[cindex];
-
-      /* Calculate distance of control points from their
-         counterparts on the line between end points */
-      dx1 = 3.0f * c->p2.x - 2.0f * c->p1.x - c->p4.x;
-      dx1 *= dx1;
-      dy1 = 3.0f * c->p2.y - 2.0f * c->p1.y - c->p4.y;
-      dy1 *= dy1;
-      dx2 = 3.0f * c->p3.x - 2.0f * c->p4.x - c->p1.x;
-      dx2 *= dx2;
-      dy2 = 3.0f * c->p3.y - 2.0f * c->p4.y - c->p1.y;
-      dy2 *= dy2;
-      if (dx1 < dx2)
-         dx1 = dx2;
-      if (dy1 < dy2)
-         dy1 = dy2;
-
-      /* Cancel if the curve is flat enough */
-      if (dx1 + dy1 <= SH_PATH_ESTIMATE_QUALITY
-          || cindex == SH_MAX_RECURSE_DEPTH - 1) {
-
-         /* Add subdivision point */
-         v.point = c->p4;
-         v.flags = 0;
-         if (cindex == 0)
-            return;             /* Skip last point */
-         if (!shAddVertex(p, &v, contourStart))
-            return;
-         --cindex;
+   SHVector2 a, b, f, df, ddf;
 
-      } else {
+   SH_ASSERT(p != NULL && quad != NULL && s != NULL);
 
-         /* Left recursion goes on top of stack! */
-         cright = c;
-         cleft = &cubics[++cindex];
-
-         /* Subdivide into 2 sub-curves */
-         SET2V(c1, c->p1);
-         ADD2V(c1, c->p2);
-         DIV2(c1, 2);
-         SET2V(mm, c->p2);
-         ADD2V(mm, c->p3);
-         DIV2(mm, 2);
-         SET2V(c5, c->p3);
-         ADD2V(c5, c->p4);
-         DIV2(c5, 2);
-
-         SET2V(c2, c1);
-         ADD2V(c2, mm);
-         DIV2(c2, 2);
-         SET2V(c4, mm);
-         ADD2V(c4, c5);
-         DIV2(c4, 2);
-
-         SET2V(c3, c2);
-         ADD2V(c3, c4);
-         DIV2(c3, 2);
-
-         /* Add left recursion to stack */
-         cleft->p1 = c->p1;
-         cleft->p2 = c1;
-         cleft->p3 = c2;
-         cleft->p4 = c3;
-
-         /* Add right recursion to stack */
-         cright->p1 = c3;
-         cright->p2 = c4;
-         cright->p3 = c5;
-         cright->p4 = c->p4;
-      }
+   /* B(t) = a t^2 + b t + p1 */
+   SET2(a, quad->p1.x - 2 * quad->p2.x + quad->p3.x,
+           quad->p1.y - 2 * quad->p2.y + quad->p3.y);
+   SET2(b, 2 * (quad->p2.x - quad->p1.x), 2 * (quad->p2.y - quad->p1.y));
+
+   SHint n = shReserveCurveVertices(p,
+                SH_SQRT(NORM2(a) / (4 * s->tolerance)));
+   SHfloat h = 1.0f / n, h2 = h * h;
+
+   f = quad->p1;
+   SET2(df, a.x * h2 + b.x * h, a.y * h2 + b.y * h);
+   SET2(ddf, 2 * a.x * h2, 2 * a.y * h2);
+
+   for (SHint i = 1; i < n; ++i) {
+      ADD2V(f, df);
+      ADD2V(df, ddf);
+      if (!shAddVertex(p, s, &f, 0))
+         return;
    }
 }
 
 static void
-shSubrecurseArc(SHPath * restrict p, SHArc * arc,
-                SHVector2 * c, SHVector2 * ux, SHVector2 * uy,
-                SHint * restrict contourStart)
+shSubdivideCubic(SHPath * restrict p, SHCubic * cubic,
+                 SHFlattenState * restrict s)
 {
-   SHVertex v;
-   SHfloat am, cosa, sina, dx, dy;
-   SHVector2 uux, uuy, c1, m;
-   SHArc arcs[SH_MAX_RECURSE_DEPTH];
-   SHArc *a, *aleft, *aright;
-   SHint aindex = 0;
-
-   SH_ASSERT(p != NULL && arc != NULL && c != NULL && ux != NULL && uy != NULL && contourStart != NULL);
-   arcs[0] = *arc;
-
-   
-   while (aindex >= 0) {
-
-      a = &arcs[aindex];
-
-      /* Middle angle and its cos/sin */
-      am = (a->a1 + a->a2) / 2;
-      cosa = SH_COS(am);
-      sina = SH_SIN(am);
-
-      /* New point */
-      SET2V(uux, (*ux));
-      MUL2(uux, cosa);
-      SET2V(uuy, (*uy));
-      MUL2(uuy, sina);
-      SET2V(c1, (*c));
-      ADD2V(c1, uux);
-      ADD2V(c1, uuy);
-
-      /* Check distance from linear midpoint */
-      SET2V(m, a->p1);
-      ADD2V(m, a->p2);
-      DIV2(m, 2);
-      dx = SH_ABS(c1.x - m.x);
-      dy = SH_ABS(c1.y - m.y);
-
-      /* Stop if flat enough */
-      if (dx + dy <= SH_PATH_ESTIMATE_QUALITY
-          || aindex == SH_MAX_RECURSE_DEPTH - 1) {
-
-         /* Add middle subdivision point */
-         v.point = c1;
-         v.flags = 0;
-         if (!shAddVertex(p, &v, contourStart))
-            return;
-         if (aindex == 0)
-            return;             /* Skip very last point */
-
-         /* Add end subdivision point */
-         v.point = a->p2;
-         v.flags = 0;
-         if (!shAddVertex(p, &v, contourStart))
-            return;
-         --aindex;
-
-      } else {
+   SHVector2 a, b, c, d1, d2, f, df, ddf, dddf;
+
+   SH_ASSERT(p != NULL && cubic != NULL && s != NULL);
+
+   /* Second differences of the control polygon */
+   SET2(d1, cubic->p1.x - 2 * cubic->p2.x + cubic->p3.x,
+            cubic->p1.y - 2 * cubic->p2.y + cubic->p3.y);
+   SET2(d2, cubic->p2.x - 2 * cubic->p3.x + cubic->p4.x,
+            cubic->p2.y - 2 * cubic->p3.y + cubic->p4.y);
+
+   SHint n = shReserveCurveVertices(p,
+                SH_SQRT(3 * SH_MAX(NORM2(d1), NORM2(d2)) /
+                        (4 * s->tolerance)));
+   SHfloat h = 1.0f / n, h2 = h * h, h3 = h2 * h;
+
+   /* B(t) = a t^3 + b t^2 + c t + p1 */
+   SET2(a, d2.x - d1.x, d2.y - d1.y);
+   SET2(b, 3 * d1.x, 3 * d1.y);
+   SET2(c, 3 * (cubic->p2.x - cubic->p1.x), 3 * (cubic->p2.y - cubic->p1.y));
+
+   f = cubic->p1;
+   SET2(df, a.x * h3 + b.x * h2 + c.x * h, a.y * h3 + b.y * h2 + c.y * h);
+   SET2(ddf, 6 * a.x * h3 + 2 * b.x * h2, 6 * a.y * h3 + 2 * b.y * h2);
+   SET2(dddf, 6 * a.x * h3, 6 * a.y * h3);
+
+   for (SHint i = 1; i < n; ++i) {
+      ADD2V(f, df);
+      ADD2V(df, ddf);
+      ADD2V(ddf, dddf);
+      if (!shAddVertex(p, s, &f, 0))
+         return;
+   }
+}
 
-         /* Left subdivision goes on top of stack! */
-         aright = a;
-         aleft = &arcs[++aindex];
-//         fprintf(stderr,"aindex :%d\n", aindex) ;
-         /* Add left recursion to stack */
-         aleft->p1 = a->p1;
-         aleft->a1 = a->a1;
-         aleft->p2 = c1;
-         aleft->a2 = am;
-
-         /* Add right recursion to stack */
-         aright->p1 = c1;
-         aright->a1 = am;
-         aright->p2 = a->p2;
-         aright->a2 = a->a2;
-      }
+static void
+shSubdivideArc(SHPath * restrict p, SHArc * arc,
+               SHVector2 * c, SHVector2 * ux, SHVector2 * uy,
+               SHFlattenState * restrict s)
+{
+   SHVector2 v;
+   SHfloat tolerance = s->tolerance;
+
+   SH_ASSERT(p != NULL && arc != NULL && c != NULL && ux != NULL && uy != NULL && s != NULL);
+
+   /* Chord of angle step s deviates r(1 - cos(s/2)) from a
+      circle of radius r. Use a radius no ellipse exceeds */
+   SHfloat r = SH_SQRT(DOT2((*ux), (*ux)) + DOT2((*uy), (*uy)));
+   SHfloat span = SH_ABS(arc->a2 - arc->a1);
+   SHfloat step = (r > tolerance ?
+                   2 * SH_ACOS(1.0f - tolerance / r) : span);
+
+   SHint n = shReserveCurveVertices(p, step > 0.0f ? span / step : 1.0f);
+   SHfloat da = (arc->a2 - arc->a1) / n;
+   SHfloat cosd = SH_COS(da), sind = SH_SIN(da);
+   SHfloat cosa = SH_COS(arc->a1), sina = SH_SIN(arc->a1);
+
+   for (SHint i = 1; i < n; ++i) {
+      SHfloat t = cosa * cosd - sina * sind;
+      sina = sina * cosd + cosa * sind;
+      cosa = t;
+      SET2(v, c->x + ux->x * cosa + uy->x * sina,
+              c->y + ux->y * cosa + uy->y * sina);
+      if (!shAddVertex(p, s, &v, 0))
+         return;
    }
 }
 
 static void
-shSubdivideSegment(SHPath * restrict p, VGPathSegment segment,
+shSubdivideSegment(SHPath * restrict p, SHint index,
+                   VGPathSegment segment,
                    VGPathCommand originalCommand,
                    SHfloat * data, void *userData)
 {
    SH_ASSERT(p != NULL && data != NULL && userData != NULL);
 
-   SHVertex v;
-   SHint *contourStart = ((SHint **) userData)[0];
-   SHint *surfaceSpace = ((SHint **) userData)[1];
+   SHFlattenState *s = (SHFlattenState *) userData;
+   SHVector2 v;
+   SHuint8 flags;
    SHQuad quad;
    SHCubic cubic;
    SHArc arc;
    SHVector2 c, ux, uy;
-   VG_GETCONTEXT(VG_NO_RETVAL);
 
    switch (segment) {
    case VG_MOVE_TO:
 
       /* Set contour start here */
-      (*contourStart) = p->vertices.size;
+      s->contourStart = p->vertices.size;
+      shIntArrayPushBack(&p->contours, 0);
 
       /* First contour vertex */
-      v.point.x = data[2];
-      v.point.y = data[3];
-      v.flags = 0;
-      if (*surfaceSpace)
-         TRANSFORM2(v.point, context->pathTransform);
+      SET2(v, data[2], data[3]);
+      flags = 0;
       break;
 
    case VG_CLOSE_PATH:
 
       /* Last contour vertex */
-      v.point.x = data[2];
-      v.point.y = data[3];
-      v.flags = SH_VERTEX_FLAG_SEGEND | SH_VERTEX_FLAG_CLOSE;
-      if (*surfaceSpace)
-         TRANSFORM2(v.point, context->pathTransform);
+      SET2(v, data[2], data[3]);
+      flags = SH_VERTEX_FLAG_SEGEND | SH_VERTEX_FLAG_CLOSE;
       break;
 
    case VG_LINE_TO:
 
       /* Last segment vertex */
-      v.point.x = data[2];
-      v.point.y = data[3];
-      v.flags = SH_VERTEX_FLAG_SEGEND;
-      if (*surfaceSpace)
-         TRANSFORM2(v.point, context->pathTransform);
+      SET2(v, data[2], data[3]);
+      flags = SH_VERTEX_FLAG_SEGEND;
       break;
 
    case VG_QUAD_TO:
 
-      /* Recurse subdivision */
+      /* Subdivide curve */
       SET2(quad.p1, data[0], data[1]);
       SET2(quad.p2, data[2], data[3]);
       SET2(quad.p3, data[4], data[5]);
-      if (*surfaceSpace) {
-         TRANSFORM2(quad.p1, context->pathTransform);
-         TRANSFORM2(quad.p2, context->pathTransform);
-         TRANSFORM2(quad.p3, context->pathTransform);
-      }
-      shSubrecurseQuad(p, &quad, contourStart);
+      shSubdivideQuad(p, &quad, s);
 
       /* Last segment vertex */
-      v.point.x = data[4];
-      v.point.y = data[5];
-      v.flags = SH_VERTEX_FLAG_SEGEND;
-      if (*surfaceSpace)
-         TRANSFORM2(v.point, context->pathTransform);
+      SET2(v, data[4], data[5]);
+      flags = SH_VERTEX_FLAG_SEGEND;
       break;
 
    case VG_CUBIC_TO:
 
-      /* Recurse subdivision */
+      /* Subdivide curve */
       SET2(cubic.p1, data[0], data[1]);
       SET2(cubic.p2, data[2], data[3]);
       SET2(cubic.p3, data[4], data[5]);
       SET2(cubic.p4, data[6], data[7]);
-      if (*surfaceSpace) {
-         TRANSFORM2(cubic.p1, context->pathTransform);
-         TRANSFORM2(cubic.p2, context->pathTransform);
-         TRANSFORM2(cubic.p3, context->pathTransform);
-         TRANSFORM2(cubic.p4, context->pathTransform);
-      }
-      shSubrecurseCubic(p, &cubic, contourStart);
+      shSubdivideCubic(p, &cubic, s);
 
       /* Last segment vertex */
-      v.point.x = data[6];
-      v.point.y = data[7];
-      v.flags = SH_VERTEX_FLAG_SEGEND;
-      if (*surfaceSpace)
-         TRANSFORM2(v.point, context->pathTransform);
+      SET2(v, data[6], data[7]);
+      flags = SH_VERTEX_FLAG_SEGEND;
       break;
 
    default:
@@ -383,7 +273,7 @@ shSubdivideSegment(SHPath * restrict p, VGPathSegment segment,
       SH_ASSERT(segment == VG_SCWARC_TO || segment == VG_SCCWARC_TO ||
                 segment == VG_LCWARC_TO || segment == VG_LCCWARC_TO);
 
-      /* Recurse subdivision */
+      /* Subdivide curve */
       SET2(arc.p1, data[0], data[1]);
       SET2(arc.p2, data[10], data[11]);
       arc.a1 = data[8];
@@ -391,51 +281,269 @@ shSubdivideSegment(SHPath * restrict p, VGPathSegment segment,
       SET2(c, data[2], data[3]);
       SET2(ux, data[4], data[5]);
       SET2(uy, data[6], data[7]);
-      if (*surfaceSpace) {
-         TRANSFORM2(arc.p1, context->pathTransform);
-         TRANSFORM2(arc.p2, context->pathTransform);
-         TRANSFORM2(c, context->pathTransform);
-         TRANSFORM2DIR(ux, context->pathTransform);
-         TRANSFORM2DIR(uy, context->pathTransform);
-      }
-      shSubrecurseArc(p, &arc, &c, &ux, &uy, contourStart);
+      shSubdivideArc(p, &arc, &c, &ux, &uy, s);
 
       /* Last segment vertex */
-      v.point.x = data[10];
-      v.point.y = data[11];
-      v.flags = SH_VERTEX_FLAG_SEGEND;
-      if (*surfaceSpace) {
-         TRANSFORM2(v.point, context->pathTransform);
-      }
+      SET2(v, data[10], data[11]);
+      flags = SH_VERTEX_FLAG_SEGEND;
       break;
    }
 
    /* Add subdivision vertex */
-   shAddVertex(p, &v, contourStart);
+   shAddVertex(p, s, &v, flags);
+
+   /* Path length up to the end of this raw segment */
+   if (p->vertices.size > 0)
+      p->segmentLengths.items[index] = s->length;
+}
+
+/*--------------------------------------------------
+ * Returns VG_TRUE if a closed contour is convex: all
+ * its turns go the same way and its edges change x
+ * and y direction at most twice each, so it winds
+ * around only once. Zero-length edges are skipped.
+ *--------------------------------------------------*/
+
+static VGboolean
+shIsContourConvex(const SHVector2 * restrict v, SHint n)
+{
+   SHint first = -1;
+   SHint turn = 0, xflips = 0, yflips = 0;
+   SHVector2 prev, e;
+
+   if (n < 3)
+      return VG_TRUE;
+
+   for (SHint i = 0; i < n && first < 0; ++i) {
+      SET2(e, v[(i + 1) % n].x - v[i].x,
+              v[(i + 1) % n].y - v[i].y);
+      if (e.x != 0.0f || e.y != 0.0f)
+         first = i;
+   }
+   if (first < 0)
+      return VG_TRUE;
+
+   SET2(prev, v[(first + 1) % n].x - v[first].x,
+              v[(first + 1) % n].y - v[first].y);
+
+   for (SHint k = 1; k <= n; ++k) {
+      SHint i = (first + k) % n;
+      SET2(e, v[(i + 1) % n].x - v[i].x,
+              v[(i + 1) % n].y - v[i].y);
+      if (e.x == 0.0f && e.y == 0.0f)
+         continue;
+
+      /* Nearly collinear edges don't count as turns */
+      SHfloat cross = prev.x * e.y - prev.y * e.x;
+      if (cross * cross > 1e-12f * DOT2(prev, prev) * DOT2(e, e)) {
+         SHint t = cross > 0.0f ? 1 : -1;
+         if (turn == 0)
+            turn = t;
+         else if (t != turn)
+            return VG_FALSE;
+      }
+
+      if ((e.x > 0.0f && prev.x < 0.0f) || (e.x < 0.0f && prev.x > 0.0f))
+         xflips++;
+      if ((e.y > 0.0f && prev.y < 0.0f) || (e.y < 0.0f && prev.y > 0.0f))
+         yflips++;
+      if (xflips > 2 || yflips > 2)
+         return VG_FALSE;
+
+      prev = e;
+   }
+
+   return VG_TRUE;
 }
 
 /*--------------------------------------------------
  * Processes path data by simplfying it and sending
- * each segment to subdivision callback function
+ * each segment to subdivision callback function.
+ * The same pass sets the contour sizes, the bounds
+ * and the length of the path up to each raw segment,
+ * so later queries don't walk the path again.
  *--------------------------------------------------*/
 
-void
-shFlattenPath(SHPath * restrict p, SHint surfaceSpace)
+static void
+shFlattenSegments(SHPath * restrict p, SHFlattenState * restrict state)
 {
-   SHint contourStart = -1;
-   SHint *userData[2];
    SHint processFlags =
       SH_PROCESS_SIMPLIFY_LINES |
       SH_PROCESS_SIMPLIFY_CURVES |
       SH_PROCESS_CENTRALIZE_ARCS | SH_PROCESS_REPAIR_ENDS;
+   SHint first = p->flattenEnd.seg;
+
+   /* Segments dropped while processing are marked -1 */
+   shFloatArrayReserveAndCopy(&p->segmentLengths, p->segCount);
+   p->segmentLengths.size = p->segCount;
+   for (SHint i = first; i < p->segCount; ++i)
+      p->segmentLengths.items[i] = -1.0f;
+
+   shProcessPathTail(p, &p->flattenEnd, processFlags,
+                     shSubdivideSegment, state);
+
+   for (SHint i = first; i < p->segCount; ++i)
+      if (p->segmentLengths.items[i] < 0.0f)
+         p->segmentLengths.items[i] = (i > 0 ? p->segmentLengths.items[i - 1] : 0.0f);
+   p->flattenValid = VG_TRUE;
+   p->measureValid = VG_FALSE;
+}
+
+void
+shFlattenPath(SHPath * restrict p, SHfloat tolerance)
+{
+   SHFlattenState state;
 
    SH_ASSERT(p != NULL);
 
-   userData[0] = &contourStart;
-   userData[1] = &surfaceSpace;
+   state.contourStart = -1;
+   state.tolerance = tolerance;
+   state.length = 0.0f;
+
+   p->vertices.size = 0;
+   p->vertexFlags.size = 0;
+   p->contours.size = 0;
+   SET2(p->min, 0.0f, 0.0f);
+   SET2(p->max, 0.0f, 0.0f);
+   memset(&p->flattenEnd, 0, sizeof(SHPathCursor));
+   p->flattenTolerance = tolerance;
+
+   shFlattenSegments(p, &state);
+
+   p->fillBufferCount = 0;
+   p->fillIndicesValid = VG_FALSE;
+   p->fillArea = -1.0f;
+   p->meshValid = VG_FALSE;
+   p->meshUses = 0;
+   p->cacheStrokeTessValid = VG_FALSE;
+
+   /* A single convex contour can be filled without stencil */
+   p->convex = p->vertices.size > 0 && p->contours.size == 1 &&
+               shIsContourConvex(p->vertices.items, p->vertices.size);
+}
 
-   shVertexArrayClear(&p->vertices);
-   shProcessPathData(p, processFlags, shSubdivideSegment, userData);
+/*--------------------------------------------------
+ * Flattens the segments appended to the path since
+ * it was flattened, with the same tolerance, adding
+ * them to the vertices. The open contour, the path
+ * length and the bounds carry on from where the
+ * previous pass stopped. The vertices already in GL
+ * buffers, the measured fill area and the stroke
+ * are kept, only the data depending on the whole
+ * path is invalidated.
+ *--------------------------------------------------*/
+
+void
+shFlattenPathTail(SHPath * restrict p)
+{
+   SHFlattenState state;
+
+   SH_ASSERT(p != NULL);
+
+   SHint oldSize = p->vertices.size;
+   SHint first = p->flattenEnd.seg;
+   state.contourStart = (p->contours.size > 0 ?
+                         oldSize - p->contours.items[p->contours.size - 1] : -1);
+   state.tolerance = p->flattenTolerance;
+   state.length = (first > 0 ? p->segmentLengths.items[first - 1] : 0.0f);
+
+   shFlattenSegments(p, &state);
+
+   if (p->vertices.size == oldSize)
+      return;
+
+   p->fillIndicesValid = VG_FALSE;
+   p->meshValid = VG_FALSE;
+   p->meshUses = 0;
+
+   /* A concave contour is left to the stencil even if
+      the appended data made it convex */
+   p->convex = (p->convex || oldSize == 0) && p->contours.size == 1 &&
+               shIsContourConvex(p->vertices.items, p->vertices.size);
+}
+
+/*--------------------------------------------------
+ * Douglas-Peucker simplification of the flattened
+ * contours: drops the vertices closer than the
+ * tolerance to the chord of the run they are in.
+ * Contour ends are always kept, so closing flags
+ * survive, and a convex contour stays convex.
+ *--------------------------------------------------*/
+
+void
+shSimplifyPath(VGContext * c, SHPath * restrict p, SHfloat tolerance)
+{
+   SH_ASSERT(c != NULL && p != NULL);
+
+   SHint nverts = p->vertices.size;
+   SHuint8 *keep = shArenaAlloc(&c->frameArena, nverts + 1);
+   SHint *stack = shArenaAlloc(&c->frameArena, 2 * nverts * sizeof(SHint) + 1);
+   SHVector2 *v = p->vertices.items;
+   SHfloat tol2 = tolerance * tolerance;
+   SHint out = 0;
+
+   if (!keep || !stack || nverts == 0)
+      return;
+
+   memset(keep, 0, nverts);
+   for (SHint k = 0, start = 0; k < p->contours.size; ++k) {
+      SHint n = p->contours.items[k];
+      SHint top = 0;
+
+      if (n > 0) {
+         keep[start] = keep[start + n - 1] = 1;
+         stack[top++] = start;
+         stack[top++] = start + n - 1;
+      }
+
+      /* Split each run at its farthest vertex */
+      while (top > 0) {
+         SHint b = stack[--top];
+         SHint a = stack[--top];
+         SHVector2 d, e;
+         SHfloat len2, far2 = tol2;
+         SHint far = -1;
+
+         SET2(d, v[b].x - v[a].x, v[b].y - v[a].y);
+         len2 = DOT2(d, d);
+         for (SHint i = a + 1; i < b; ++i) {
+            SHfloat t = 0.0f, dist2;
+            SET2(e, v[i].x - v[a].x, v[i].y - v[a].y);
+            if (len2 > 0.0f)
+               t = SH_CLAMPF(DOT2(e, d) / len2);
+            SET2(e, e.x - t * d.x, e.y - t * d.y);
+            dist2 = DOT2(e, e);
+            if (dist2 > far2) {
+               far2 = dist2;
+               far = i;
+            }
+         }
+
+         if (far >= 0) {
+            keep[far] = 1;
+            stack[top++] = a;
+            stack[top++] = far;
+            stack[top++] = far;
+            stack[top++] = b;
+         }
+      }
+
+      /* Compact the kept vertices of the contour */
+      SHint count = 0;
+      for (SHint i = start; i < start + n; ++i) {
+         if (keep[i]) {
+            v[out] = v[i];
+            p->vertexFlags.items[out] = p->vertexFlags.items[i];
+            ++out;
+            ++count;
+         }
+      }
+      p->contours.items[k] = count;
+      start += n;
+   }
+
+   p->vertices.size = out;
+   p->vertexFlags.size = out;
 }
 
 /*-------------------------------------------
@@ -605,11 +713,13 @@ shStrokeCapSquare(SHPath * p, SHVector2 * c, SHVector2 * t, SHint start)
 /*-----------------------------------------------------------
  * Generates stroke of a path according to VGContext state.
  * Produces quads for every linear subdivision segment or
- * dash "on" segment, handles line caps and joins.
+ * dash "on" segment, handles line caps and joins. Starts
+ * from the path's stroke cursor and leaves it where the
+ * stroke can be continued when vertices get appended.
  *-----------------------------------------------------------*/
 
-void
-shStrokePath(VGContext * c, SHPath * p)
+static void
+shStrokeContours(VGContext * c, SHPath * p)
 {
    SH_ASSERT(c != NULL && p != NULL);
 
@@ -618,8 +728,13 @@ shStrokePath(VGContext * c, SHPath * p)
    SHfloat mlimit = c->strokeMiterLimit;
    SHint vertsize = p->vertices.size;
 
+   /* Resume point, updated as contours are stroked */
+   SHStrokeCursor *resume = &p->strokeEnd;
+   SHint resumeOpen = 0;
+
    /* Contour state */
-   SHint contourStart = 0;
+   SHint contour = resume->contour;
+   SHint contourStart = resume->contourStart;
    SHint contourLength = 0;
    SHint start = 0;
    SHint end = 0;
@@ -629,7 +744,7 @@ shStrokePath(VGContext * c, SHPath * p)
 
    /* Current vertices */
    SHint i1 = 0, i2 = 0;
-   SHVertex *v1, *v2;
+   const SHuint8 *flags = p->vertexFlags.items;
    SHVector2 *p1, *p2;
    SHVector2 d, t, dprev, tprev;
    SHfloat norm, cross, mlength;
@@ -638,11 +753,12 @@ shStrokePath(VGContext * c, SHPath * p)
    SHVector2 l1, r1, l2, r2, lprev, rprev;
 
    /* Dash state */
-   SHint dashIndex = 0;
-   SHfloat dashLength = 0.0f, strokeLength = 0.0f;
+   SHint dashIndex = resume->dashIndex;
+   SHfloat dashLength = resume->dashLength;
+   SHfloat strokeLength = resume->strokeLength;
    SHint dashSize = c->strokeDashPattern.size;
    SHfloat *dashPattern = c->strokeDashPattern.items;
-   SHint dashOn = 1;
+   SHint dashOn = resume->dashOn;
 
    /* Dash edge points */
    SHVector2 dash1, dash2;
@@ -653,16 +769,19 @@ shStrokePath(VGContext * c, SHPath * p)
    /* Discard odd dash segment */
    dashSize -= dashSize % 2;
 
-   /* Init previous so compiler doesn't warn
-      for uninitialized usage */
-   SET2(tprev, 0, 0);
-   SET2(dprev, 0, 0);
-   SET2(lprev, 0, 0);
-   SET2(rprev, 0, 0);
+   /* Previous edge where stroking resumes (zero for
+      a contour start, so compiler doesn't warn) */
+   tprev = resume->tprev;
+   dprev = resume->dprev;
+   lprev = resume->lprev;
+   rprev = resume->rprev;
 
+   /* Resuming inside the last contour, which has grown */
+   if (resume->vertex > contourStart)
+      contourLength = p->contours.items[contour++];
 
    /* Walk over subdivision vertices */
-   for (i1 = 0; i1 < vertsize; ++i1) {
+   for (i1 = resume->vertex; i1 < vertsize; ++i1) {
 
       if (loop) {
          /* Start new contour if exists */
@@ -677,7 +796,16 @@ shStrokePath(VGContext * c, SHPath * p)
 
       if (i1 == contourStart) {
          /* Contour has started. Get length */
-         contourLength = p->vertices.items[i1].flags;
+         resume->vertex = i1;
+         resume->contour = contour;
+         resume->contourStart = i1;
+         resume->strokeSize = p->stroke.size;
+         resume->dashIndex = dashIndex;
+         resume->dashOn = dashOn;
+         resume->dashLength = dashLength;
+         resume->strokeLength = strokeLength;
+         resumeOpen = 0;
+         contourLength = p->contours.items[contour++];
          start = 1;
       }
 
@@ -688,18 +816,33 @@ shStrokePath(VGContext * c, SHPath * p)
          continue;
       }
 
-      v1 = &p->vertices.items[i1];
-      v2 = &p->vertices.items[i2];
-
       if (i2 == contourStart + contourLength - 1) {
          /* Contour has ended. Check close */
-         close = v2->flags & SH_VERTEX_FLAG_CLOSE;
+         close = flags[i2] & SH_VERTEX_FLAG_CLOSE;
          end = 1;
+
+         /* An open contour can grow, stroke its last
+            edge and caps again from here if it does */
+         if (!close) {
+            resume->vertex = i1;
+            resume->contour = contour - 1;
+            resume->contourStart = contourStart;
+            resume->strokeSize = p->stroke.size;
+            resume->lprev = lprev;
+            resume->rprev = rprev;
+            resume->dprev = dprev;
+            resume->tprev = tprev;
+            resume->dashIndex = dashIndex;
+            resume->dashOn = dashOn;
+            resume->dashLength = dashLength;
+            resume->strokeLength = strokeLength;
+            resumeOpen = 1;
+         }
       }
 
       if (i1 == contourStart + contourLength - 1) {
          /* Loop back to first edge. Check close */
-         close = v1->flags & SH_VERTEX_FLAG_CLOSE;
+         close = flags[i1] & SH_VERTEX_FLAG_CLOSE;
          i2 = contourStart + 1;
          contourStart = i1 + 1;
          i1 = i2 - 1;
@@ -708,7 +851,7 @@ shStrokePath(VGContext * c, SHPath * p)
 
       if (!start && !loop) {
          /* We are inside a contour. Check segment end. */
-         segend = (v1->flags & SH_VERTEX_FLAG_SEGEND);
+         segend = (flags[i1] & SH_VERTEX_FLAG_SEGEND);
       }
 
       if (dashSize > 0 && start &&
@@ -740,11 +883,9 @@ shStrokePath(VGContext * c, SHPath * p)
          }
       }
 
-      /* Subdiv segment vertices and points */
-      v1 = &p->vertices.items[i1];
-      v2 = &p->vertices.items[i2];
-      p1 = &v1->point;
-      p2 = &v2->point;
+      /* Subdiv segment points */
+      p1 = &p->vertices.items[i1];
+      p2 = &p->vertices.items[i2];
 
       /* Direction vector */
       SET2(d, p2->x - p1->x, p2->y - p1->y);
@@ -921,8 +1062,54 @@ shStrokePath(VGContext * c, SHPath * p)
       dprev = d;
       tprev = t;
    }
+
+   /* Stroking goes on after a finished last contour */
+   if (!resumeOpen && (p->contours.size == 0 ||
+                       p->contours.items[p->contours.size - 1] > 1)) {
+      memset(resume, 0, sizeof(SHStrokeCursor));
+      resume->vertex = vertsize;
+      resume->contour = p->contours.size;
+      resume->contourStart = vertsize;
+      resume->strokeSize = p->stroke.size;
+      resume->dashIndex = dashIndex;
+      resume->dashOn = dashOn;
+      resume->dashLength = dashLength;
+      resume->strokeLength = strokeLength;
+   }
+   resume->vertices = vertsize;
 }
 
+void
+shStrokePath(VGContext * c, SHPath * p)
+{
+   SH_ASSERT(c != NULL && p != NULL);
+
+   p->strokeBufferCount = 0;
+   p->strokeArea = -1.0f;
+
+   memset(&p->strokeEnd, 0, sizeof(SHStrokeCursor));
+   p->strokeEnd.dashOn = 1;
+   shStrokeContours(c, p);
+}
+
+/*-----------------------------------------------------------
+ * Strokes the vertices added to a path since it was
+ * stroked with the same parameters. The end of the last
+ * contour is stroked again if it grew, the rest of the
+ * stroke and its uploaded part are kept.
+ *-----------------------------------------------------------*/
+
+void
+shStrokePathTail(VGContext * c, SHPath * p)
+{
+   SH_ASSERT(c != NULL && p != NULL);
+
+   p->stroke.size = p->strokeEnd.strokeSize;
+   p->strokeBufferCount = SH_MIN(p->strokeBufferCount, p->stroke.size);
+   shStrokeContours(c, p);
+}
+
+
 
 /*-------------------------------------------------------------
  * Transforms the tessellation vertices using the given matrix
@@ -935,9 +1122,13 @@ shTransformVertices(SHMatrix3x3 * restrict m, SHPath * restrict p)
 
    SHVector2 *v;
    for (SHint i = p->vertices.size - 1; i >= 0; --i) {
-      v = (&p->vertices.items[i].point);
+      v = &p->vertices.items[i];
       TRANSFORM2((*v), (*m));
    }
+   p->fillBufferCount = 0;
+   p->fillArea = -1.0f;
+   p->meshValid = VG_FALSE;
+   p->measureValid = VG_FALSE;
 }
 
 /*--------------------------------------------------------
@@ -957,12 +1148,12 @@ shFindBoundbox(SHPath * restrict p)
       return;
    }
 
-   p->min.x = p->max.x = p->vertices.items[0].point.x;
-   p->min.y = p->max.y = p->vertices.items[0].point.y;
+   p->min.x = p->max.x = p->vertices.items[0].x;
+   p->min.y = p->max.y = p->vertices.items[0].y;
 
    for (SHint i = 0; i < p->vertices.size; ++i) {
 
-      SHVector2 *v = &p->vertices.items[i].point;
+      SHVector2 *v = &p->vertices.items[i];
       if (v->x < p->min.x)
          p->min.x = v->x;
       if (v->x > p->max.x)
@@ -974,160 +1165,34 @@ shFindBoundbox(SHPath * restrict p)
    }
 }
 
-/*-------------------------------------------------
- * Approximates path length of Quadratic Bezier
- *-------------------------------------------------*/
-
-static float
-shBezQuadLen(float x0, float y0, float x1, float y1, float x2, float y2)
-{
-   SHVector2 p0, p1, p2;
-   SHVector2 a, b;
-   float A, B, C, Sabc, A_2, A_32, C_2, BA;
-
-   SET2(p0, x0, y0);
-   SET2(p1, x1, y1);
-   SET2(p2, x2, y2);
-
-
-   a.x = p0.x - 2 * p1.x + p2.x;
-   a.y = p0.y - 2 * p1.y + p2.y;
-   b.x = 2 * p1.x - 2 * p0.x;
-   b.y = 2 * p1.y - 2 * p0.y;
-   A = 4 * (a.x * a.x + a.y * a.y);
-   B = 4 * (a.x * b.x + a.y * b.y);
-   C = b.x * b.x + b.y * b.y;
-
-   Sabc = 2 * SH_SQRT(A + B + C);
-   A_2 = SH_SQRT(A);
-   A_32 = 2 * A * A_2;
-   C_2 = 2 * SH_SQRT(C);
-   BA = B / A_2;
-
-   return (A_32 * Sabc + A_2 * B * (Sabc - C_2) +
-           (4 * C * A -
-            B * B) * SH_LOG((2 * A_2 + BA + Sabc) / (BA + C_2))) / (4 * A_32);
-}
-
-/*--------------------------------------------------------
- * Calculates the path length of a segment
- *--------------------------------------------------------*/
+/*--------------------------------------------------
+ * Queries measure the path flattened at the query
+ * tolerance and never simplified, whatever it was
+ * drawn with. Vertices flattened for drawing, per
+ * scale bucket, are set aside as a cached level
+ * first, and the query vertices belong to no bucket
+ * so that the next draw sets them aside in turn.
+ *--------------------------------------------------*/
 
 static void
-shPathLength(SHPath * p, VGPathSegment segment,
-             VGPathCommand originalCommand, SHfloat * data, void *userData)
+shFlattenPathForQuery(SHPath * restrict p)
 {
-   SH_ASSERT(p != NULL && data != NULL && userData != NULL);
-   SHfloat *sum = (SHfloat *) ((void **) userData)[0];
-   SHint *startSegment = (SHint *) ((void **) userData)[1];
-   SHint *numSegments = (SHint *) ((void **) userData)[2];
-   SHuint *curSegment = (SHuint *) ((void **) userData)[3];
-
-   SHPath *q = NULL;
-   SHVertex v;
-   SHCubic cubic;
-   SHArc arc;
-   SHVector2 c, ux, uy;
-   SHint contour = 0;
-
-   /* skip segments before "start" position */
-   if (*curSegment < *startSegment) {
-      (*curSegment)++;
-      return;
-   }
-   /* stop working once we pass requested number of segments */
-   if (*curSegment >= *startSegment + *numSegments) {
+   if (p->flattenValid && p->cacheBucket == SH_PATH_LOD_NONE &&
+       p->flattenTolerance == SH_PATH_FLATTEN_TOLERANCE)
       return;
-   }
 
-   switch (segment) {
-   case VG_CLOSE_PATH:
-   case VG_LINE_TO:
-      *sum += SH_DIST(data[0], data[1], data[2], data[3]);
-      break;
-   case VG_QUAD_TO:
-      *sum +=
-         shBezQuadLen(data[0], data[1], data[2], data[3], data[4], data[5]);
-      break;
-   case VG_CUBIC_TO:
-      /* temporary path to store vertexes without messing up user's path */
-      SH_NEWOBJ(SHPath, q);     /* @todo: out of memory error here? */
-
-      /* segment start as first vertex */
-      v.point.x = data[0];
-      v.point.y = data[1];
-      v.flags = 0;
-      shAddVertex(q, &v, &contour);
-
-      /* recursively find vertex points along segment */
-      SET2(cubic.p1, data[0], data[1]);
-      SET2(cubic.p2, data[2], data[3]);
-      SET2(cubic.p3, data[4], data[5]);
-      SET2(cubic.p4, data[6], data[7]);
-      shSubrecurseCubic(q, &cubic, &contour);
-
-      /* final segment point as vertex */
-      v.point.x = data[6];
-      v.point.y = data[7];
-      shAddVertex(q, &v, &contour);
-
-      /* add linear distance from each vertex */
-      for (int i = 0; i < q->vertices.size - 1; i++) {
-         *sum +=
-            SH_DIST(q->vertices.items[i].point.x,
-                    q->vertices.items[i].point.y,
-                    q->vertices.items[i + 1].point.x,
-                    q->vertices.items[i + 1].point.y);
-      }
-      SH_DELETEOBJ(SHPath, (SHPath *) q);
-      break;
-   case VG_SCCWARC_TO:
-   case VG_SCWARC_TO:
-   case VG_LCCWARC_TO:
-   case VG_LCWARC_TO:
-      SH_NEWOBJ(SHPath, q);
-
-      /* segment start as first vertex */
-      v.point.x = data[0];
-      v.point.y = data[1];
-      v.flags = 0;
-      shAddVertex(q, &v, &contour);
-
-      /* Recurse subdivision */
-      SET2(arc.p1, data[0], data[1]);
-      SET2(arc.p2, data[10], data[11]);
-      arc.a1 = data[8];
-      arc.a2 = data[9];
-      SET2(c, data[2], data[3]);
-      SET2(ux, data[4], data[5]);
-      SET2(uy, data[6], data[7]);
-      shSubrecurseArc(q, &arc, &c, &ux, &uy, &contour);
-
-
-      /* final segment point as vertex */
-      v.point.x = data[10];
-      v.point.y = data[11];
-      shAddVertex(q, &v, &contour);
-
-      /* add linear distance from each vertex */
-      for (int i = 0; i < q->vertices.size - 1; i++) {
-         *sum +=
-            SH_DIST(q->vertices.items[i].point.x,
-                    q->vertices.items[i].point.y,
-                    q->vertices.items[i + 1].point.x,
-                    q->vertices.items[i + 1].point.y);
-      }
-
-      SH_DELETEOBJ(SHPath, (SHPath *) q);
-      break;
-   case VG_MOVE_TO:            /* no drawn path, not counted in length */
-      break;
-   default:
-      
-      break;
+   if (p->cacheBucket != SH_PATH_LOD_NONE) {
+      SHPathLOD *l = &p->lods[0];
+      for (SHint i = 1; i < SH_PATH_LOD_COUNT && l->bucket != SH_PATH_LOD_NONE; ++i)
+         if (p->lods[i].bucket == SH_PATH_LOD_NONE ||
+             p->lods[i].lastUse < l->lastUse)
+            l = &p->lods[i];
+      shSwapPathLOD(p, l);
+      l->lastUse = ++p->lodClock;
    }
 
-   (*curSegment)++;
+   shFlattenPath(p, SH_PATH_FLATTEN_TOLERANCE);
+   p->cacheBucket = SH_PATH_LOD_NONE;
 }
 
 /*--------------------------------------------------------
@@ -1153,13 +1218,12 @@ vgPathBounds(VGPath path,
 
    /* TODO: check output pointer alignment */
 
-   p = (SHPath *) path;
+   p = shGetPath(context, path);
    VG_RETURN_ERR_IF(!(p->caps & VG_PATH_CAPABILITY_PATH_BOUNDS),
                     VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
-   /* Update path geometry */
-   shFlattenPath(p, 0);
-   shFindBoundbox(p);
+   /* Bounds are found while flattening */
+   shFlattenPathForQuery(p);
 
    /* Output bounds */
    *minX = p->min.x;
@@ -1193,15 +1257,18 @@ vgPathTransformedBounds(VGPath path,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
 
-   p = (SHPath *) path;
+   p = shGetPath(context, path);
    /* check output pointer alignment */
-   SH_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(p), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
+   VG_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(p), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
    VG_RETURN_ERR_IF(!(p->caps & VG_PATH_CAPABILITY_PATH_BOUNDS),
                     VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
    /* Update path geometry */
-   shFlattenPath(p, 1);
+   SHfloat scale = shMatrixMaxScale(&context->pathTransform);
+   shFlattenPath(p, scale > 0.0f ? SH_PATH_FLATTEN_TOLERANCE / scale
+                                 : SH_PATH_FLATTEN_TOLERANCE);
+   shTransformVertices(&context->pathTransform, p);
    shFindBoundbox(p);
 
    /* Output bounds */
@@ -1210,8 +1277,9 @@ vgPathTransformedBounds(VGPath path,
    *width = p->max.x - p->min.x;
    *height = p->max.y - p->min.y;
 
-   /* Invalidate subdivision for rendering */
+   /* Invalidate subdivision for rendering and queries */
    p->cacheDataValid = VG_FALSE;
+   p->flattenValid = VG_FALSE;
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -1219,12 +1287,6 @@ vgPathTransformedBounds(VGPath path,
 VG_API_CALL VGfloat
 vgPathLength(VGPath path, VGint startSegment, VGint numSegments)
 {
-   void *userData[4];
-   VGfloat sum = 0;
-   SHuint i = 0;
-   SHint processFlags =
-      SH_PROCESS_SIMPLIFY_LINES |
-      SH_PROCESS_SIMPLIFY_CURVES | SH_PROCESS_CENTRALIZE_ARCS;
    SHPath *p = NULL;
 
    VG_GETCONTEXT(-1.0f); // return -1.0f if an error occurs
@@ -1232,7 +1294,7 @@ vgPathLength(VGPath path, VGint startSegment, VGint numSegments)
    VG_RETURN_ERR_IF(!shIsValidPath(context, path),
                     VG_BAD_HANDLE_ERROR, -1.0f);
 
-   p = (SHPath *) path;
+   p = shGetPath(context, path);
    VG_RETURN_ERR_IF(!(p->caps & VG_PATH_CAPABILITY_PATH_LENGTH),
                     VG_PATH_CAPABILITY_ERROR, -1.0f);
 
@@ -1245,16 +1307,68 @@ vgPathLength(VGPath path, VGint startSegment, VGint numSegments)
    VG_RETURN_ERR_IF((startSegment + numSegments - 1 >= p->segCount),
                     VG_ILLEGAL_ARGUMENT_ERROR, -1.0f);
 
-   userData[0] = &sum;
-   userData[1] = &startSegment;
-   userData[2] = &numSegments;
-   userData[3] = &i;
+   /* Lengths up to each segment are found while flattening */
+   shFlattenPathForQuery(p);
 
-   shProcessPathData(p, processFlags, shPathLength, userData);
+   SHfloat *lengths = p->segmentLengths.items;
+   VGfloat sum = lengths[startSegment + numSegments - 1] -
+                 (startSegment > 0 ? lengths[startSegment - 1] : 0.0f);
 
    VG_RETURN(sum);
 }
 
+/*--------------------------------------------------
+ * Measures the running length and the unit tangent
+ * of the incoming edge at each flattened vertex (the
+ * outgoing one for contour starts). Lengths don't
+ * grow across the gap between contours. Only needed
+ * for queries along the path, so it is done lazily.
+ *--------------------------------------------------*/
+
+static void
+shMeasurePath(SHPath * restrict p)
+{
+   SHint n = p->vertices.size;
+   SHfloat length = 0.0f;
+
+   shFloatArrayReserve(&p->vertexLengths, n);
+   shVector2ArrayReserve(&p->vertexTangents, n);
+   p->vertexLengths.size = n;
+   p->vertexTangents.size = n;
+
+   const SHVector2 *v = p->vertices.items;
+   SHfloat *l = p->vertexLengths.items;
+   SHVector2 *t = p->vertexTangents.items;
+
+   for (SHint k = 0, start = 0; k < p->contours.size; ++k) {
+      SHint end = start + p->contours.items[k];
+      if (end > n)
+         end = n;
+      if (start < end) {
+         l[start] = length;
+         SET2(t[start], 1.0f, 0.0f);
+      }
+      for (SHint i = start + 1; i < end; ++i) {
+         SHVector2 d;
+         SET2(d, v[i].x - v[i - 1].x, v[i].y - v[i - 1].y);
+         SHfloat len = NORM2(d);
+         length += len;
+         l[i] = length;
+         if (len > 0.0f) {
+            DIV2(d, len);
+            t[i] = d;
+            if (i - 1 == start)
+               t[start] = d;
+         } else {
+            t[i] = t[i - 1];
+         }
+      }
+      start = end;
+   }
+
+   p->measureValid = VG_TRUE;
+}
+
 VG_API_CALL void
 vgPointAlongPath(VGPath path,
                  VGint startSegment, VGint numSegments,
@@ -1267,13 +1381,21 @@ vgPointAlongPath(VGPath path,
    VG_RETURN_ERR_IF(!shIsValidPath(context, path),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   SHPath *p = (SHPath *) path;
+   SHPath *p = shGetPath(context, path);
    VG_RETURN_ERR_IF(
       (x && y && !(p->caps & VG_PATH_CAPABILITY_POINT_ALONG_PATH)) || (tangentX && tangentY && !(p->caps & VG_PATH_CAPABILITY_TANGENT_ALONG_PATH)),
       VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
    VG_RETURN_ERR_IF((startSegment < 0 || numSegments <= 0 || shAddSaturate(startSegment, numSegments) > p->segCount), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
+   shFlattenPathForQuery(p);
+   if (!p->measureValid)
+      shMeasurePath(p);
+
+   const SHVector2 *points = p->vertices.items;
+   const SHfloat *lengths = p->vertexLengths.items;
+   const SHVector2 *tangents = p->vertexTangents.items;
+
    VGint startVertex = 0;
    // skip the move segment at the start of the path
    while (numSegments && (p->segs[startSegment] & ~VG_RELATIVE) == VG_MOVE_TO) {
@@ -1299,30 +1421,30 @@ vgPointAlongPath(VGPath path,
       *y=0.0f;
       *tangentX = 1.0f;
       *tangentY = 0.0f;
-      return ;
+      VG_RETURN(VG_NO_RETVAL);
    }
 
-   VGfloat length = p->vertices.items[startVertex].length;
+   VGfloat length = lengths[startVertex];
    distance += length;
 
    if (distance <= length) {
       // return the info about first point of the path
-      *x = p->vertices.items[startVertex].point.x;
-      *y = p->vertices.items[startVertex].point.y;
-      *tangentX = p->vertices.items[startVertex].tangent.x;
-      *tangentY = p->vertices.items[startVertex].tangent.y;
-      return;
+      *x = points[startVertex].x;
+      *y = points[startVertex].y;
+      *tangentX = tangents[startVertex].x;
+      *tangentY = tangents[startVertex].y;
+      VG_RETURN(VG_NO_RETVAL);
    }
 
    // now consider the distance from ending segment point
-   length = p->vertices.items[endVertex].length;
+   length = lengths[endVertex];
    if (distance >= length) {
       // return the info about the last point of the path
-      *x = p->vertices.items[endVertex].point.x;
-      *y = p->vertices.items[endVertex].point.y;
-      *tangentX = p->vertices.items[endVertex].tangent.x;
-      *tangentY = p->vertices.items[endVertex].tangent.y;
-      return;
+      *x = points[endVertex].x;
+      *y = points[endVertex].y;
+      *tangentX = tangents[endVertex].x;
+      *tangentY = tangents[endVertex].y;
+      VG_RETURN(VG_NO_RETVAL);
    }
 
    // search for the segment at given distance, then interpolate
@@ -1333,8 +1455,8 @@ vgPointAlongPath(VGPath path,
 
    SHfloat32 startLength, endLength;
    while (end <= endVertex ) {
-      startLength = p->vertices.items[start].length;
-      endLength = p->vertices.items[end].length;
+      startLength = lengths[start];
+      endLength = lengths[end];
 
       if (distance >= startLength && distance < endLength) {
          //segment found, now interpolate linearly between its end points.
@@ -1343,14 +1465,192 @@ vgPointAlongPath(VGPath path,
 
          SHfloat32 r = (distance - startLength) / edgeLength;
 
-         *x = (1.0f - r) * p->vertices.items[start].point.x + r * p->vertices.items[end].point.x;
-         *y = (1.0f - r) * p->vertices.items[start].point.y + r * p->vertices.items[end].point.y;
-         *tangentX = (1.0f - r) * p->vertices.items[start].tangent.x + r * p->vertices.items[end].tangent.x;
-         *tangentY = (1.0f - r) * p->vertices.items[start].tangent.y + r * p->vertices.items[end].tangent.y;
-         return ;
+         *x = (1.0f - r) * points[start].x + r * points[end].x;
+         *y = (1.0f - r) * points[start].y + r * points[end].y;
+         *tangentX = (1.0f - r) * tangents[start].x + r * tangents[end].x;
+         *tangentY = (1.0f - r) * tangents[start].y + r * tangents[end].y;
+         VG_RETURN(VG_NO_RETVAL);
       }
       ++start; ++end;
    }
    // Not found? If we are here, there is a bug.
    SH_ASSERT(0);
+   VG_RETURN(VG_NO_RETVAL);
+}
+
+/*--------------------------------------------------
+ * Triangulates the flattened contours of a path for
+ * the given fill rule. The plane is cut into slabs at
+ * every vertex and edge crossing height. Inside a slab
+ * edges don't cross, so walking them left to right
+ * while counting windings gives the filled spans, and
+ * each span is emitted as a trapezoid of 2 triangles.
+ * The triangles don't overlap, so the mesh can be drawn
+ * straight into the color buffer without the stencil.
+ * Returns VG_FALSE if the path is too complex.
+ *--------------------------------------------------*/
+
+typedef struct
+{
+   SHfloat x0, y0, y1;
+   SHfloat dxdy;
+   SHint dir;
+
+} SHTriEdge;
+
+typedef struct
+{
+   SHfloat xa, xb, xm;
+   SHint dir;
+
+} SHTriCrossing;
+
+static int
+shCompareTriEdges(const void *a, const void *b)
+{
+   SHfloat ya = ((const SHTriEdge *) a)->y0;
+   SHfloat yb = ((const SHTriEdge *) b)->y0;
+   return (ya > yb) - (ya < yb);
+}
+
+static int
+shCompareFloats(const void *a, const void *b)
+{
+   SHfloat fa = *(const SHfloat *) a;
+   SHfloat fb = *(const SHfloat *) b;
+   return (fa > fb) - (fa < fb);
+}
+
+static inline SHfloat
+shTriEdgeX(const SHTriEdge * restrict e, SHfloat y)
+{
+   return e->x0 + (y - e->y0) * e->dxdy;
+}
+
+static inline void
+shPushTriangle(SHVector2Array * restrict mesh, SHfloat x1, SHfloat y1,
+               SHfloat x2, SHfloat y2, SHfloat x3, SHfloat y3)
+{
+   SHVector2 v;
+   SET2(v, x1, y1); shVector2ArrayPushBackP(mesh, &v);
+   SET2(v, x2, y2); shVector2ArrayPushBackP(mesh, &v);
+   SET2(v, x3, y3); shVector2ArrayPushBackP(mesh, &v);
+}
+
+VGboolean
+shTriangulatePath(VGContext * c, SHPath * p, VGFillRule rule)
+{
+   SH_ASSERT(c != NULL && p != NULL);
+
+   SHint nverts = p->vertices.size;
+   SHint maxYs = nverts + SH_TRIANGULATE_MAX_CROSSINGS;
+   SHTriEdge *edges = shArenaAlloc(&c->frameArena, nverts * sizeof(SHTriEdge) + 1);
+   SHTriCrossing *xs = shArenaAlloc(&c->frameArena, nverts * sizeof(SHTriCrossing) + 1);
+   SHint *active = shArenaAlloc(&c->frameArena, nverts * sizeof(SHint) + 1);
+   SHfloat *ys = shArenaAlloc(&c->frameArena, maxYs * sizeof(SHfloat));
+   SHint nedges = 0, nys = 0;
+
+   if (!edges || !xs || !active || !ys)
+      return VG_FALSE;
+
+   /* Collect the non horizontal edges of the closed contours */
+   for (SHint k = 0, start = 0; k < p->contours.size; ++k) {
+      SHint n = p->contours.items[k];
+      const SHVector2 *v = &p->vertices.items[start];
+      for (SHint i = 0; i < n; ++i) {
+         SHVector2 a = v[i];
+         SHVector2 b = v[(i + 1) % n];
+         ys[nys++] = a.y;
+         if (a.y == b.y)
+            continue;
+         SHTriEdge *e = &edges[nedges++];
+         e->dir = 1;
+         if (a.y > b.y) {
+            SHVector2 t = a; a = b; b = t;
+            e->dir = -1;
+         }
+         e->x0 = a.x;
+         e->y0 = a.y;
+         e->y1 = b.y;
+         e->dxdy = (b.x - a.x) / (b.y - a.y);
+      }
+      start += n;
+   }
+
+   shVector2ArrayClear(&p->mesh);
+   if (nedges == 0)
+      return VG_TRUE;
+
+   qsort(edges, nedges, sizeof(SHTriEdge), shCompareTriEdges);
+
+   /* Add the heights where edges cross each other */
+   for (SHint i = 0; i < nedges; ++i) {
+      const SHTriEdge *e = &edges[i];
+      for (SHint j = i + 1; j < nedges && edges[j].y0 < e->y1; ++j) {
+         const SHTriEdge *f = &edges[j];
+         SHfloat ylo = SH_MAX(e->y0, f->y0);
+         SHfloat yhi = SH_MIN(e->y1, f->y1);
+         SHfloat dlo = shTriEdgeX(e, ylo) - shTriEdgeX(f, ylo);
+         SHfloat dhi = shTriEdgeX(e, yhi) - shTriEdgeX(f, yhi);
+         if ((dlo < 0.0f && dhi > 0.0f) || (dlo > 0.0f && dhi < 0.0f)) {
+            if (nys == maxYs)
+               return VG_FALSE;
+            ys[nys++] = ylo + (yhi - ylo) * dlo / (dlo - dhi);
+         }
+      }
+   }
+
+   qsort(ys, nys, sizeof(SHfloat), shCompareFloats);
+
+   /* Sweep the slabs keeping a list of the edges spanning them */
+   SHint nactive = 0, next = 0;
+   for (SHint s = 0; s + 1 < nys; ++s) {
+      SHfloat ya = ys[s], yb = ys[s + 1];
+      if (yb <= ya)
+         continue;
+
+      SHint k = 0;
+      for (SHint i = 0; i < nactive; ++i)
+         if (edges[active[i]].y1 > ya)
+            active[k++] = active[i];
+      nactive = k;
+      while (next < nedges && edges[next].y0 <= ya) {
+         if (edges[next].y1 > ya)
+            active[nactive++] = next;
+         ++next;
+      }
+
+      /* Sort crossings by their x in the middle of the slab */
+      SHint nxs = 0;
+      for (SHint i = 0; i < nactive; ++i) {
+         const SHTriEdge *e = &edges[active[i]];
+         SHTriCrossing x;
+         x.xa = shTriEdgeX(e, ya);
+         x.xb = shTriEdgeX(e, yb);
+         x.xm = 0.5f * (x.xa + x.xb);
+         x.dir = e->dir;
+         SHint j = nxs++;
+         while (j > 0 && xs[j - 1].xm > x.xm) {
+            xs[j] = xs[j - 1];
+            --j;
+         }
+         xs[j] = x;
+      }
+
+      SHint winding = 0, left = 0;
+      for (SHint i = 0; i < nxs; ++i) {
+         VGboolean wasIn = (rule == VG_EVEN_ODD ? (winding & 1) : winding) != 0;
+         winding += xs[i].dir;
+         VGboolean isIn = (rule == VG_EVEN_ODD ? (winding & 1) : winding) != 0;
+         if (!wasIn && isIn) {
+            left = i;
+         } else if (wasIn && !isIn) {
+            const SHTriCrossing *l = &xs[left], *r = &xs[i];
+            shPushTriangle(&p->mesh, l->xa, ya, r->xa, ya, r->xb, yb);
+            shPushTriangle(&p->mesh, l->xa, ya, r->xb, yb, l->xb, yb);
+         }
+      }
+   }
+
+   return VG_TRUE;
 }
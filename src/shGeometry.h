@@ -28,9 +28,27 @@
 
 #define SH_PATH_ESTIMATE_QUALITY 0.005f
 
-void shFlattenPath(SHPath * p, SHint surfaceSpace);
+/* Maximum distance between a flattened curve and its chords */
+#define SH_PATH_FLATTEN_TOLERANCE (SH_PATH_ESTIMATE_QUALITY / 2)
+
+/* Maximum distance in device pixels between a contour and
+   its simplification below VG_RENDERING_QUALITY_BETTER,
+   converted to the path's units for each scale bucket */
+#define SH_PATH_SIMPLIFY_TOLERANCE 0.25f
+
+/* Paths are triangulated once they have been filled this
+   many times without changing, if they are small enough */
+#define SH_TRIANGULATE_MIN_USES      2
+#define SH_TRIANGULATE_MAX_VERTICES  4096
+#define SH_TRIANGULATE_MAX_CROSSINGS 8192
+
+void shFlattenPath(SHPath * p, SHfloat tolerance);
+void shFlattenPathTail(SHPath * p);
+void shSimplifyPath(VGContext * c, SHPath * p, SHfloat tolerance);
 void shStrokePath(VGContext * c, SHPath * p);
+void shStrokePathTail(VGContext * c, SHPath * p);
 void shTransformVertices(SHMatrix3x3 * m, SHPath * p);
 void shFindBoundbox(SHPath * p);
+VGboolean shTriangulatePath(VGContext * c, SHPath * p, VGFillRule rule);
 
 #endif /* __SH_GEOMETRY_H */
@@ -36,12 +36,6 @@
 #define _COMPARE_T(c1,c2) 0
 #include "shArrayBase.h"
 
-#define _ITEM_T SHImage*
-#define _ARRAY_T SHImageArray
-#define _FUNC_T shImageArray
-#define _ARRAY_DEFINE
-#include "shArrayBase.h"
-
 #define SH_BASE_IMAGE_FORMAT(format) ((format) & 0x1F)
 
 static inline SHfloat
@@ -591,6 +585,24 @@ SHImage_dtor(SHImage * i)
       glDeleteTextures(1, &i->texture);
 }
 
+/*--------------------------------------------------------
+ * Image recycler. Pixel data depends on the image size so
+ * it is released, the GL texture name is kept for reuse.
+ *--------------------------------------------------------*/
+
+void
+SHImage_recycle(SHImage * i)
+{
+   SH_ASSERT(i != NULL);
+
+   if (i->data != NULL)
+      free(i->data);
+
+   i->data = NULL;
+   i->width = 0;
+   i->height = 0;
+}
+
 /*--------------------------------------------------------
  * Finds appropriate OpenGL texture size for the size of
  * the given image 
@@ -682,7 +694,7 @@ VG_API_CALL VGImage vgCreateImage(VGImageFormat format,
 
    /* Create new image object */
    SHImage *i = NULL;
-   SH_NEWOBJ(SHImage, i);
+   SH_NEWPOOLOBJ(SHImage, context->imagePool, i);
    VG_RETURN_ERR_IF(!i, VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
    i->width = width;
    i->height = height;
@@ -690,10 +702,10 @@ VG_API_CALL VGImage vgCreateImage(VGImageFormat format,
 
    /* Allocate data memory */
    shUpdateImageTextureSize(i);
-   i->data = (SHuint8 *) malloc(i->stride * i->texheight);
+   i->data = (SHuint8 *) SH_MALLOC(i->stride * i->texheight);
 
    if (i->data == NULL) {
-      SH_DELETEOBJ(SHImage, i);
+      SH_DELETEPOOLOBJ(SHImage, context->imagePool, i);
       VG_RETURN_ERR(VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
    }
 
@@ -702,24 +714,29 @@ VG_API_CALL VGImage vgCreateImage(VGImageFormat format,
 
    shUpdateImageTexture(i, context);
 
-   /* Add to resource list */
-   shImageArrayPushBack(&context->images, i);
+   /* Add to resource table */
+   VGImage handle = shCreateHandle(context, i, SH_RESOURCE_IMAGE);
+   if (handle == VG_INVALID_HANDLE) {
+      SH_DELETEPOOLOBJ(SHImage, context->imagePool, i);
+      VG_RETURN_ERR(VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
+   }
 
-   VG_RETURN((VGImage) i);
+   VG_RETURN(handle);
 }
 
 VG_API_CALL void
 vgDestroyImage(VGImage image)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Check if valid resource */
-   SHint index = shImageArrayFind(&context->images, (SHImage *) image);
-   VG_RETURN_ERR_IF(index == -1, VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
+   SHImage *i = shGetImage(context, image);
+   VG_RETURN_ERR_IF(!i, VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
    /* Delete object and remove resource */
-   SH_DELETEOBJ(SHImage, (SHImage *) image);
-   shImageArrayRemoveAt(&context->images, index);
+   SH_DELETEPOOLOBJ(SHImage, context->imagePool, i);
+   shReleaseHandle(context, image);
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -733,13 +750,14 @@ VG_API_CALL void
 vgClearImage(VGImage image, VGint x, VGint y, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidImage(context, image),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
    /* TODO: check if image current render target */
 
-   SHImage *i = (SHImage *) image;
+   SHImage *i = shGetImage(context, image);
    VG_RETURN_ERR_IF(width <= 0 || height <= 0,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
@@ -922,12 +940,13 @@ vgImageSubData(VGImage image,
                VGint x, VGint y, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidImage(context, image),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
    /* TODO: check if image current render target */
-   SHImage *i = (SHImage *) image;
+   SHImage *i = shGetImage(context, image);
 
    /* Reject invalid formats */
    VG_RETURN_ERR_IF(!shIsValidImageFormat(dataFormat),
@@ -982,7 +1001,7 @@ vgGetImageSubData(VGImage image,
    VG_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(data), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
    /* TODO: check if image current render target */
-   SHImage *img = (SHImage *) image;
+   SHImage *img = shGetImage(context, image);
 
    shCopyPixels(data, dataFormat, dataStride,
                 img->data, img->fd.vgformat, img->stride,
@@ -1004,6 +1023,7 @@ vgCopyImage(VGImage dst, VGint dx, VGint dy,
             VGint width, VGint height, VGboolean dither)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidImage(context, src) ||
                     !shIsValidImage(context, dst),
@@ -1011,8 +1031,8 @@ vgCopyImage(VGImage dst, VGint dx, VGint dy,
 
    /* TODO: check if images current render target */
 
-   SHImage *s = (SHImage *) src;
-   SHImage *d = (SHImage *) dst;
+   SHImage *s = shGetImage(context, src);
+   SHImage *d = shGetImage(context, dst);
    VG_RETURN_ERR_IF(width <= 0 || height <= 0,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
@@ -1030,8 +1050,8 @@ vgCopyImage(VGImage dst, VGint dx, VGint dy,
                    d->width, d->height, width, height,
                    dx, dy, 0, 0, width, height);
    } else {
-      SHuint8 *pixels = (SHuint8 *) malloc(width * height * s->fd.bytes);
-      SH_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, SH_NO_RETVAL);
+      SHuint8 *pixels = (SHuint8 *) shArenaAlloc(&context->frameArena, width * height * s->fd.bytes);
+      VG_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
       shCopyPixels(pixels, s->fd.vgformat, s->stride,
                    s->data, s->fd.vgformat, s->stride,
@@ -1042,8 +1062,6 @@ vgCopyImage(VGImage dst, VGint dx, VGint dy,
                    pixels, s->fd.vgformat, s->stride,
                    d->width, d->height, width, height,
                    dx, dy, 0, 0, width, height);
-
-      free(pixels);
    }
 
    shUpdateImageTexture(d, context);
@@ -1061,13 +1079,14 @@ vgSetPixels(VGint dx, VGint dy,
             VGImage src, VGint sx, VGint sy, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidImage(context, src),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
    /* TODO: check if image current render target (requires EGL) */
 
-   SHImage *i = (SHImage *) src;
+   SHImage *i = shGetImage(context, src);
    VG_RETURN_ERR_IF(width <= 0 || height <= 0,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
@@ -1081,8 +1100,8 @@ vgSetPixels(VGint dx, VGint dy,
       manually copy the image data and write from a copy with
       normal row length (without power-of-two roundup pixels) */
 
-   SHuint8 *pixels = (SHuint8 *) malloc(width * height * winfd.bytes);
-   SH_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, SH_NO_RETVAL);
+   SHuint8 *pixels = (SHuint8 *) shArenaAlloc(&context->frameArena, width * height * winfd.bytes);
+   VG_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    shCopyPixels(pixels, winfd.vgformat, -1,
                 i->data, i->fd.vgformat, i->stride,
@@ -1101,7 +1120,6 @@ vgSetPixels(VGint dx, VGint dy,
    glBindTexture(GL_TEXTURE_2D, i->texture);
    glTexSubImage2D(GL_TEXTURE_2D, 0, dx, dy, width, height, i->fd.glintformat, i->fd.gltype, pixels);
    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-   free(pixels);
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -1118,6 +1136,7 @@ vgWritePixels(const void *data, VGint dataStride,
               VGint dx, VGint dy, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Reject invalid formats */
    VG_RETURN_ERR_IF(!shIsValidImageFormat(dataFormat),
@@ -1143,8 +1162,8 @@ vgWritePixels(const void *data, VGint dataStride,
       manually copy the image data and write from a copy with
       normal row length */
 
-   SHuint8 *pixels = (SHuint8 *) malloc(width * height * winfd.bytes);
-   SH_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, SH_NO_RETVAL);
+   SHuint8 *pixels = (SHuint8 *) shArenaAlloc(&context->frameArena, width * height * winfd.bytes);
+   VG_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    shCopyPixels(pixels, winfd.vgformat, -1,
                 (SHuint8 *) data, dataFormat, dataStride,
@@ -1169,8 +1188,6 @@ vgWritePixels(const void *data, VGint dataStride,
                   GL_UNSIGNED_BYTE, pixels);
    glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-   free(pixels);
-
    VG_RETURN(VG_NO_RETVAL);
 }
 
@@ -1186,13 +1203,14 @@ vgGetPixels(VGImage dst, VGint dx, VGint dy,
 {
 
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidImage(context, dst),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
    /* TODO: check if image current render target */
 
-   SHImage *i = (SHImage *) dst;
+   SHImage *i = shGetImage(context, dst);
    VG_RETURN_ERR_IF(width <= 0 || height <= 0,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
@@ -1206,8 +1224,8 @@ vgGetPixels(VGImage dst, VGint dx, VGint dy,
       coordinates nor using random stride. We have to
       read first and then manually copy to the image data */
 
-   SHuint8 *pixels = (SHuint8 *) malloc(width * height * winfd.bytes);
-   SH_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, SH_NO_RETVAL);
+   SHuint8 *pixels = (SHuint8 *) shArenaAlloc(&context->frameArena, width * height * winfd.bytes);
+   VG_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    glPixelStorei(GL_PACK_ALIGNMENT, 1);
 /*
@@ -1230,8 +1248,6 @@ vgGetPixels(VGImage dst, VGint dx, VGint dy,
                 i->width, i->height, width, height,
                 dx, dy, 0, 0, width, height);
 
-   free(pixels);
-
    shUpdateImageTexture(i, context);
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -1248,6 +1264,7 @@ vgReadPixels(void *data, VGint dataStride,
              VGint sx, VGint sy, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Reject invalid formats */
    VG_RETURN_ERR_IF(!shIsValidImageFormat(dataFormat),
@@ -1271,8 +1288,8 @@ vgReadPixels(void *data, VGint dataStride,
    /* OpenGL doesn't allow random data stride. We have to
       read first and then manually copy to the output buffer */
 
-   SHuint8 *pixels = (SHuint8 *) malloc(width * height * winfd.bytes);
-   SH_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, SH_NO_RETVAL);
+   SHuint8 *pixels = (SHuint8 *) shArenaAlloc(&context->frameArena, width * height * winfd.bytes);
+   VG_RETURN_ERR_IF(!pixels, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    glPixelStorei(GL_PACK_ALIGNMENT, 1);
    glReadPixels(sx, sy, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
@@ -1281,8 +1298,6 @@ vgReadPixels(void *data, VGint dataStride,
                 pixels, winfd.vgformat, -1,
                 width, height, width, height, 0, 0, 0, 0, width, height);
 
-   free(pixels);
-
    VG_RETURN(VG_NO_RETVAL);
 }
 
@@ -1297,6 +1312,7 @@ vgCopyPixels(VGint dx, VGint dy,
              VGint sx, VGint sy, VGint width, VGint height)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(width <= 0 || height <= 0,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
@@ -1337,8 +1353,8 @@ vgColorMatrix(VGImage dst, VGImage src, const VGfloat * matrix)
    VG_GETCONTEXT(VG_NO_RETVAL);
    VG_RETURN_ERR_IF(!shIsValidImage(context, src) || !shIsValidImage(context, dst), VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   SHImage* d = (SHImage*) dst;
-   SHImage* s = (SHImage*) src;
+   SHImage* d = shGetImage(context, dst);
+   SHImage* s = shGetImage(context, src);
 
    VG_RETURN_ERR_IF(shOverlaps(s, d, 0, 0, 0, 0, s->width, s->height ), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
    VG_RETURN_ERR_IF(!matrix || SH_IS_NOT_ALIGNED(matrix), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
@@ -1487,8 +1503,8 @@ vgConvolve(VGImage dst, VGImage src,
                     VG_NO_RETVAL);
    VG_RETURN_ERR_IF(tilingMode < VG_TILE_FILL || tilingMode > VG_TILE_REFLECT, VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
-   SHImage *d = (SHImage*) dst;
-   SHImage *s = (SHImage*) src;
+   SHImage *d = shGetImage(context, dst);
+   SHImage *s = shGetImage(context, src);
    VG_RETURN_ERR_IF(
       shOverlaps(s, d, 0, 0, 0, 0, s->width, s->height),
       VG_ILLEGAL_ARGUMENT_ERROR,
@@ -1500,8 +1516,7 @@ vgConvolve(VGImage dst, VGImage src,
 
    VGbitfield channelMask = context->filterChannelMask;
    SHColor edge = context->tileFillColor;
-   // TODO: replace malloc with a "safe" malloc that always test return pointer with assert
-   SHColor *tmpColors = (SHColor *) malloc(s->width * s->height * sizeof(SHColor));
+   SHColor *tmpColors = (SHColor *) shArenaAlloc(&context->frameArena, s->width * s->height * sizeof(SHColor));
    SH_ASSERT(tmpColors != NULL);
 
    // copy source image region to tmp buffer
@@ -1558,7 +1573,6 @@ vgConvolve(VGImage dst, VGImage src,
          shStorePixelColor(&cs, d->data, &(d->fd), j, i, d->stride);
       }
    }
-   free(tmpColors);
 
    shUpdateImageTexture(d, context);
    VG_RETURN(VG_NO_RETVAL);
@@ -1586,8 +1600,8 @@ vgSeparableConvolve(VGImage dst, VGImage src,
                     VG_NO_RETVAL);
    VG_RETURN_ERR_IF(tilingMode < VG_TILE_FILL || tilingMode > VG_TILE_REFLECT, VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
-   SHImage *d = (SHImage*) dst;
-   SHImage *s = (SHImage*) src;
+   SHImage *d = shGetImage(context, dst);
+   SHImage *s = shGetImage(context, src);
    VG_RETURN_ERR_IF(
       shOverlaps(s, d, 0, 0, 0, 0, s->width, s->height),
       VG_ILLEGAL_ARGUMENT_ERROR,
@@ -1600,7 +1614,7 @@ vgSeparableConvolve(VGImage dst, VGImage src,
    VGbitfield channelMask = context->filterChannelMask;
    SHColor edge = context->tileFillColor;
 
-   SHColor *tmpColors = (SHColor *) malloc(w * h * sizeof(SHColor));
+   SHColor *tmpColors = (SHColor *) shArenaAlloc(&context->frameArena, w * h * sizeof(SHColor));
    SH_ASSERT(tmpColors != NULL);
    // copy source image region to tmp buffer
    SHColor c;
@@ -1612,7 +1626,7 @@ vgSeparableConvolve(VGImage dst, VGImage src,
    }
 
    // TODO: mmh, I guess this second buffer can be removed.
-   SHColor *tmpColors2 = (SHColor *) malloc(w * h * sizeof(SHColor));
+   SHColor *tmpColors2 = (SHColor *) shArenaAlloc(&context->frameArena, w * h * sizeof(SHColor));
    SH_ASSERT(tmpColors2 != NULL);
 
    const SHColor *tmpc; // pointer to a color from tempColors array
@@ -1681,17 +1695,15 @@ vgSeparableConvolve(VGImage dst, VGImage src,
       }
    }
 
-   free(tmpColors);
-   free(tmpColors2);
    shUpdateImageTexture(d, context);
    VG_RETURN(VG_NO_RETVAL);
 }
 
 static inline SHfloat *
-shMakeGaussianBlurKernel(int kernelElement, SHfloat expScale, SHfloat * restrict scale, int * restrict kernelSize)
+shMakeGaussianBlurKernel(SHArena * arena, int kernelElement, SHfloat expScale, SHfloat * restrict scale, int * restrict kernelSize)
 {
    *kernelSize = kernelElement * 2 + 1;
-   SHfloat *kernel = (SHfloat *) malloc((*kernelSize) * sizeof(SHfloat));
+   SHfloat *kernel = (SHfloat *) shArenaAlloc(arena, (*kernelSize) * sizeof(SHfloat));
    SH_ASSERT(kernel != NULL); // Should return an error ?
 
    SHfloat32 tmp = *scale;
@@ -1713,8 +1725,8 @@ vgGaussianBlur(VGImage dst, VGImage src,
    VG_RETURN_ERR_IF(tilingMode < VG_TILE_FILL || tilingMode > VG_TILE_REFLECT, VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
    VG_RETURN_ERR_IF(stdDeviationX > SH_MAX_GAUSSIAN_STD_DEVIATION || stdDeviationY > SH_MAX_GAUSSIAN_STD_DEVIATION, VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
-   SHImage *d = (SHImage*) dst;
-   SHImage *s = (SHImage*) src;
+   SHImage *d = shGetImage(context, dst);
+   SHImage *s = shGetImage(context, src);
    VG_RETURN_ERR_IF(
       shOverlaps(s, d, 0, 0, 0, 0, s->width, s->height),
       VG_ILLEGAL_ARGUMENT_ERROR,
@@ -1739,11 +1751,11 @@ vgGaussianBlur(VGImage dst, VGImage src,
    SHfloat *kernelX, *kernelY;
    SHint kernelXSize, kernelYSize;
 
-   kernelX = shMakeGaussianBlurKernel(kernelWidth, expScaleX, &scaleX, &kernelXSize);
-   kernelY = shMakeGaussianBlurKernel(kernelHeight, expScaleY, &scaleY, &kernelYSize);
+   kernelX = shMakeGaussianBlurKernel(&context->frameArena, kernelWidth, expScaleX, &scaleX, &kernelXSize);
+   kernelY = shMakeGaussianBlurKernel(&context->frameArena, kernelHeight, expScaleY, &scaleY, &kernelYSize);
 
    SHColor edge = context->tileFillColor;
-   SHColor *tmpColors = (SHColor *) malloc(w * h * sizeof(SHColor));
+   SHColor *tmpColors = (SHColor *) shArenaAlloc(&context->frameArena, w * h * sizeof(SHColor));
    SH_ASSERT(tmpColors != NULL);
 
    // copy source image region to tmp buffer
@@ -1789,9 +1801,6 @@ vgGaussianBlur(VGImage dst, VGImage src,
          shStorePixelColor(&sum, d->data, &(d->fd), j, i, d->stride);
       }
    }
-   free(tmpColors);
-   free(kernelX);
-   free(kernelY);
 
    shUpdateImageTexture(d, context);
    VG_RETURN(VG_NO_RETVAL);
@@ -1808,8 +1817,8 @@ vgLookup(VGImage dst, VGImage src,
    VG_GETCONTEXT(VG_NO_RETVAL);
    VG_RETURN_ERR_IF(!shIsValidImage(context, src) || !shIsValidImage(context, dst), VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   SHImage *d = (SHImage*) dst;
-   SHImage *s = (SHImage*) src;
+   SHImage *d = shGetImage(context, dst);
+   SHImage *s = shGetImage(context, src);
    VG_RETURN_ERR_IF(
       shOverlaps(s, d, 0, 0, 0, 0, s->width, s->height),
       VG_ILLEGAL_ARGUMENT_ERROR,
@@ -1876,8 +1885,8 @@ vgLookupSingle(VGImage dst, VGImage src,
    VG_GETCONTEXT(VG_NO_RETVAL);
    VG_RETURN_ERR_IF(!shIsValidImage(context, src) || !shIsValidImage(context, dst), VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   SHImage *d = (SHImage*) dst;
-   SHImage *s = (SHImage*) src;
+   SHImage *d = shGetImage(context, dst);
+   SHImage *s = shGetImage(context, src);
    VG_RETURN_ERR_IF(
       shOverlaps(s, d, 0, 0, 0, 0, s->width, s->height),
       VG_ILLEGAL_ARGUMENT_ERROR,
@@ -94,12 +94,7 @@ typedef struct
 
 void SHImage_ctor(SHImage * i);
 void SHImage_dtor(SHImage * i);
-
-#define _ITEM_T SHImage*
-#define _ARRAY_T SHImageArray
-#define _FUNC_T shImageArray
-#define _ARRAY_DECLARE
-#include "shArrayBase.h"
+void SHImage_recycle(SHImage * i);
 
 /*-------------------------------------------------------
  * Color operators
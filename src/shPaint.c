@@ -33,18 +33,8 @@
 #define _ARRAY_DEFINE
 #include "shArrayBase.h"
 
-#define _ITEM_T SHPaint*
-#define _ARRAY_T SHPaintArray
-#define _FUNC_T shPaintArray
-#define _ARRAY_DEFINE
-#include "shArrayBase.h"
 
 
-// SHuint8 rgba_s[1024*1*4];
-static SHuint8 *rgba_p = NULL ;
-static SHuint texwidth = 0;
-extern VGContext   *vg_context;
-
 void
 SHPaint_ctor(SHPaint * p)
 {
@@ -67,6 +57,7 @@ SHPaint_ctor(SHPaint * p)
 
    p->granularity = 0.01 ;
    p->pattern = VG_INVALID_HANDLE;
+   p->handle = VG_INVALID_HANDLE;
 
    glGenTextures(1, &p->texture);
 }
@@ -83,36 +74,89 @@ SHPaint_dtor(SHPaint * p)
       glDeleteTextures(1, &p->texture);
 }
 
+/*--------------------------------------------------------
+ * Paint recycler. Resets the paint to its constructed
+ * state keeping the stop arrays and the ramp texture so
+ * the paint can be reused from the context pool.
+ *--------------------------------------------------------*/
+
+void
+SHPaint_recycle(SHPaint * p)
+{
+   SH_ASSERT(p != NULL);
+
+   p->type = VG_PAINT_TYPE_COLOR;
+   CSET(p->color, 0, 0, 0, 1);    // Black
+
+   p->instops.size = 0;
+   p->stops.size = 0;
+
+   p->premultiplied = VG_FALSE;
+   p->spreadMode = VG_COLOR_RAMP_SPREAD_PAD;
+   p->tilingMode = VG_TILE_FILL;
+
+   for (int i = 0; i < 4; ++i)
+      p->linearGradient[i] = 0.0f;
+   for (int i = 0; i < 5; ++i)
+      p->radialGradient[i] = 0.0f;
+
+   p->granularity = 0.01 ;
+   p->pattern = VG_INVALID_HANDLE;
+   p->handle = VG_INVALID_HANDLE;
+}
+
 VG_API_CALL VGPaint vgCreatePaint(void)
 {
    SHPaint *p = NULL;
    VG_GETCONTEXT(VG_INVALID_HANDLE);
 
    /* Create new paint object */
-   SH_NEWOBJ(SHPaint, p);
+   SH_NEWPOOLOBJ(SHPaint, context->paintPool, p);
    VG_RETURN_ERR_IF(!p, VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
 
-   /* Add to resource list */
-   shPaintArrayPushBack(&context->paints, p);
+   /* Add to resource table */
+   p->handle = shCreateHandle(context, p, SH_RESOURCE_PAINT);
+   if (p->handle == VG_INVALID_HANDLE) {
+      SH_DELETEPOOLOBJ(SHPaint, context->paintPool, p);
+      VG_RETURN_ERR(VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
+   }
 
-   VG_RETURN((VGPaint) p);
+   VG_RETURN(p->handle);
 }
 
 VG_API_CALL void
 vgDestroyPaint(VGPaint paint)
 {
-   SHint index;
+   SHPaint *p;
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Check if handle valid */
-   SH_ASSERT(paint != 0);
-
-   index = shPaintArrayFind(&context->paints, (SHPaint *) paint);
-   VG_RETURN_ERR_IF(index == -1, VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
+   p = shGetPaint(context, paint);
+   VG_RETURN_ERR_IF(!p, VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
+
+   /* Unbind from every context sharing it, including
+      draws they have recorded. Their calls are locked
+      out while this one runs */
+   SHResourceGroup *g = context->resources;
+   for (SHint i = 0; i < g->contexts.size; ++i) {
+      VGContext *c = (VGContext *) g->contexts.items[i];
+      if (c->fillPaint == p)
+         c->fillPaint = NULL;
+      if (c->strokePaint == p)
+         c->strokePaint = NULL;
+      for (SHint k = 0; k < c->commands.size; ++k) {
+         SHDrawCommand *cmd = &c->commands.items[k];
+         if (cmd->fillPaint == p)
+            cmd->fillPaint = NULL;
+         if (cmd->strokePaint == p)
+            cmd->strokePaint = NULL;
+      }
+   }
 
    /* Delete object and remove resource */
-   SH_DELETEOBJ(SHPaint, (SHPaint *) paint);
-   shPaintArrayRemoveAt(&context->paints, index);
+   SH_DELETEPOOLOBJ(SHPaint, context->paintPool, p);
+   shReleaseHandle(context, paint);
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -134,9 +178,9 @@ vgSetPaint(VGPaint paint, VGbitfield paintModes)
 
    /* Set stroke / fill */
    if (paintModes & VG_STROKE_PATH)
-      context->strokePaint = (SHPaint *) paint;
+      context->strokePaint = shGetPaint(context, paint);
    if (paintModes & VG_FILL_PATH)
-      context->fillPaint = (SHPaint *) paint;
+      context->fillPaint = shGetPaint(context, paint);
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -147,16 +191,19 @@ vgGetPaint(VGPaintMode paintMode)
    VG_GETCONTEXT(VG_INVALID_HANDLE);
 
    if (paintMode & VG_STROKE_PATH)
-      VG_RETURN((VGPaint) context->strokePaint);
+      VG_RETURN(context->strokePaint ? context->strokePaint->handle
+                                     : VG_INVALID_HANDLE);
    if (paintMode & VG_FILL_PATH)
-      VG_RETURN((VGPaint) context->fillPaint);
+      VG_RETURN(context->fillPaint ? context->fillPaint->handle
+                                   : VG_INVALID_HANDLE);
 
-   return (VGPaint) VG_ILLEGAL_ARGUMENT_ERROR;
+   VG_RETURN((VGPaint) VG_ILLEGAL_ARGUMENT_ERROR);
 }
 
 VG_API_CALL void vgPaintPattern(VGPaint paint, VGImage pattern)
 {
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Check if handle valid */
    VG_RETURN_ERR_IF(!shIsValidPaint(context, paint),
@@ -169,7 +216,7 @@ VG_API_CALL void vgPaintPattern(VGPaint paint, VGImage pattern)
    /* TODO: Check if pattern image is current rendering target */
 
    /* Set pattern image */
-   ((SHPaint *) paint)->pattern = pattern; //Image
+   shGetPaint(context, paint)->pattern = pattern; //Image
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -213,7 +260,7 @@ vgGetColor(VGPaint paint)
    VGint alpha = (VGint)(SH_CLAMPF(color[3]) * 255.0f + 0.5f);
 
    // return packed rgba
-   return (red << 24) | (green << 16) | (blue << 8) | alpha;
+   VG_RETURN((red << 24) | (green << 16) | (blue << 8) | alpha);
 }
 
 void shUpdateColorRampTexture(SHPaint * p)
@@ -226,15 +273,13 @@ void shUpdateColorRampTexture(SHPaint * p)
    SHfloat k;
 
    SH_ASSERT(p != NULL);
+   SH_GETCONTEXT(SH_NO_RETVAL);
 
-// Free any previous allocation
-   if (rgba_p != NULL)
-    { free(rgba_p) ;
-      rgba_p = NULL ;
-    }
-// Allocate a chunk of space
-   if ((rgba_p = (SHuint8 *)malloc(SH_GRADIENT_TEX_COORDSIZE)) == NULL)
-    { fprintf(stderr,"Unable to malloc memory for texture\n") ;
+// Scratch space for the ramp, it only lives until the upload below
+   SHuint8 *rgba_p = (SHuint8 *) shArenaAlloc(&context->frameArena,
+                                               SH_GRADIENT_TEX_COORDSIZE);
+   if (rgba_p == NULL)
+    { fprintf(stderr,"Unable to allocate memory for texture\n") ;
       return ;
     }
 
@@ -272,7 +317,11 @@ void shUpdateColorRampTexture(SHPaint * p)
       }
    }
 
-   texwidth = cnt ;
+// Upload once, gradient draws only bind the paint texture
+   glBindTexture(GL_TEXTURE_2D, p->texture);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cnt, 1, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, rgba_p);
 }
 
 void
@@ -477,7 +526,8 @@ static void shSetPatternTexGLState(SHPaint *p, VGContext *c)
 {
    SH_ASSERT(p != NULL && c != NULL);
 
-   glBindTexture(GL_TEXTURE_2D, ((SHImage *) p->pattern)->texture);
+   SHImage *img = shGetImage(c, p->pattern);
+   glBindTexture(GL_TEXTURE_2D, img ? img->texture : 0);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 //   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -585,12 +635,10 @@ int shDrawLinearGradientMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
       quadt.p4.x = 1.0; quadt.p4.y = 1.0;
     }
 
-   GLvoid* vertices  = (GLvoid*) &quadv;
-	GLvoid* textures  = (GLvoid*) &quadt;
+   GLvoid* vertices  = (GLvoid*) shStreamVertices(&quadv, sizeof(quadv));
+	GLvoid* textures  = (GLvoid*) shStreamVertices(&quadt, sizeof(quadt));
+   shStreamFlushVertices();
 // updating attribute values
-   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texwidth, 1, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, rgba_p);
 // enabling vertex arrays
    glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0, vertices);
 	glEnableVertexAttribArray(position_loc);
@@ -606,6 +654,7 @@ int shDrawLinearGradientMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
    glDisableVertexAttribArray(position_loc);
 	glDisableVertexAttribArray(texc_loc);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
 // Reset the frag shader switch
    glUniform1i(tflag_loc, 0) ;
 
@@ -663,8 +712,9 @@ int shDrawRadialGradientMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
    quadt.p3.x = 0.0; quadt.p3.y = 0.0;
    quadt.p4.x = 0.0; quadt.p4.y = 1.0;
 
-   GLvoid* vertices  = (GLvoid*) &quadv;
-	GLvoid* textures  = (GLvoid*) &quadt;
+   GLvoid* vertices  = (GLvoid*) shStreamVertices(&quadv, sizeof(quadv));
+	GLvoid* textures  = (GLvoid*) shStreamVertices(&quadt, sizeof(quadt));
+   shStreamFlushVertices();
    SHMatrix3x3 *m;
    m = &vg_context->pathTransform;
 
@@ -678,9 +728,6 @@ int shDrawRadialGradientMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
    fprintf(stderr,"Centre: %f %f Radius: %f\n",cs.x+1.0,cs.y+1.0, r) ;
 
 // updating attribute values
-   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texwidth, 1, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, rgba_p);
 // enabling vertex arrays
    glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0, vertices);
 	glEnableVertexAttribArray(position_loc);
@@ -696,6 +743,7 @@ int shDrawRadialGradientMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
    glDisableVertexAttribArray(position_loc);
 	glDisableVertexAttribArray(texc_loc);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
 // Reset the frag shader switch
    glUniform1i(tflag_loc, 0) ;
 
@@ -745,8 +793,9 @@ int shDrawPatternMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
    quadt.p3.x = 0.0; quadt.p3.y = 0.0;
    quadt.p4.x = 0.0; quadt.p4.y = texgran;
 
-   GLvoid* vertices  = (GLvoid*) &quadv;
-	GLvoid* textures  = (GLvoid*) &quadt;
+   GLvoid* vertices  = (GLvoid*) shStreamVertices(&quadv, sizeof(quadv));
+	GLvoid* textures  = (GLvoid*) shStreamVertices(&quadt, sizeof(quadt));
+   shStreamFlushVertices();
 // updating attribute values
 // enabling vertex arrays
    glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0, vertices);
@@ -760,6 +809,8 @@ int shDrawPatternMesh(SHPaint * p, SHVector2 * min, SHVector2 * max,
 // Draw the quad
    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
    glDisableVertexAttribArray(position_loc);
+	glDisableVertexAttribArray(texc_loc);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
 // Reset the frag shader switch
    glUniform1i(tflag_loc, 0) ;
 
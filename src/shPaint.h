@@ -40,6 +40,7 @@ typedef struct
 
 typedef struct
 {
+   VGPaint handle;
    VGImage pattern;
    SHColor color;
    SHColorArray colors;
@@ -59,12 +60,7 @@ typedef struct
 
 void SHPaint_ctor(SHPaint * p);
 void SHPaint_dtor(SHPaint * p);
-
-#define _ITEM_T SHPaint*
-#define _ARRAY_T SHPaintArray
-#define _FUNC_T shPaintArray
-#define _ARRAY_DECLARE
-#include "shArrayBase.h"
+void SHPaint_recycle(SHPaint * p);
 
 void shValidateInputStops(SHPaint * p);
 
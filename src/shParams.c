@@ -493,7 +493,7 @@ VG_API_CALL void vgSetfv(VGParamType type, VGint count,
    VG_GETCONTEXT(VG_NO_RETVAL);
 
    /* check input array alignment */
-   SH_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(values), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
+   VG_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(values), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
    /* Error code will be set by shSet */
    shSet(context, type, count, values, 1);
@@ -510,7 +510,7 @@ vgSetiv(VGParamType type, VGint count, const VGint * values)
    VG_GETCONTEXT(VG_NO_RETVAL);
 
    /* check input array alignment */
-   SH_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(values), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
+   VG_RETURN_ERR_IF(SH_IS_NOT_ALIGNED(values), VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
 
    /* Error code wil be set by shSet */
    shSet(context, type, count, values, 0);
@@ -877,11 +877,18 @@ vgGetVectorSize(VGParamType type)
  * vector according to the parameter type and input type.
  *-----------------------------------------------------------*/
 
-static void shSetParameter(VGContext * context, VGHandle object,
+static void shSetParameter(VGContext * context, VGHandle handle,
                SHResourceType rtype, VGint ptype,
                SHint count, const void *values, SHint floats)
 {
    SHint ivalue = 0;
+   void *object = shGetResource(context, handle, rtype);
+
+   /* Recorded draws use the object as it is now. They keep
+      their own copy of the paint color and type */
+   if (rtype != SH_RESOURCE_PAINT ||
+       (ptype != VG_PAINT_COLOR && ptype != VG_PAINT_TYPE))
+      shFlushCommands(context);
 
    /* Check for negative count */
    SH_RETURN_ERR_IF(count < 0, VG_ILLEGAL_ARGUMENT_ERROR, SH_NO_RETVAL);
@@ -1133,10 +1140,11 @@ vgSetParameteriv(VGHandle object, VGint paramType,
  *---------------------------------------------------------------*/
 
 static void
-shGetParameter(VGContext * context, VGHandle object,
+shGetParameter(VGContext * context, VGHandle handle,
                SHResourceType rtype, VGint ptype,
                SHint count, void *values, SHint floats)
 {
+   void *object = shGetResource(context, handle, rtype);
 
 
    /* Check for invalid array / count */
@@ -1459,7 +1467,7 @@ vgGetParameterVectorSize(VGHandle object, VGint ptype)
          break;
 
       case VG_PAINT_COLOR_RAMP_STOPS:
-         retval = ((SHPaint *) object)->stops.size * 5;
+         retval = shGetPaint(context, object)->stops.size * 5;
          break;
 
       case VG_PAINT_LINEAR_GRADIENT:
@@ -25,19 +25,6 @@
 #include <string.h>
 #include <stdio.h>
 
-#define _ITEM_T SHVertex
-#define _ARRAY_T SHVertexArray
-#define _FUNC_T shVertexArray
-#define _COMPARE_T(v1,v2) 0
-#define _ARRAY_DEFINE
-#include "shArrayBase.h"
-
-#define _ITEM_T SHPath*
-#define _ARRAY_T SHPathArray
-#define _FUNC_T shPathArray
-#define _ARRAY_DEFINE
-#include "shArrayBase.h"
-
 
 static const SHint shCoordsPerCommand[] = {
    0,                           /* VG_CLOSE_PATH */
@@ -85,9 +72,57 @@ SHPath_ctor(SHPath * p)
    p->data = NULL;
    p->segCount = 0;
    p->dataCount = 0;
-
-   SH_INITOBJ(SHVertexArray, p->vertices);
+   p->segCapacity = 0;
+   p->dataCapacity = 0;
+
+   SH_INITOBJ(SHUint8Array, p->compiledSegs);
+   SH_INITOBJ(SHFloatArray, p->compiledData);
+   memset(&p->compiledEnd, 0, sizeof(SHPathCursor));
+   p->compiledValid = VG_FALSE;
+
+   SH_INITOBJ(SHVector2Array, p->vertices);
+   SH_INITOBJ(SHUint8Array, p->vertexFlags);
+   SH_INITOBJ(SHIntArray, p->contours);
+   SH_INITOBJ(SHFloatArray, p->segmentLengths);
+   memset(&p->flattenEnd, 0, sizeof(SHPathCursor));
+   p->flattenTolerance = 0.0f;
+   p->flattenValid = VG_FALSE;
+   SH_INITOBJ(SHFloatArray, p->vertexLengths);
+   SH_INITOBJ(SHVector2Array, p->vertexTangents);
+   p->measureValid = VG_FALSE;
    SH_INITOBJ(SHVector2Array, p->stroke);
+   memset(&p->strokeEnd, 0, sizeof(SHStrokeCursor));
+   SH_INITOBJ(SHVector2Array, p->mesh);
+
+   p->convex = VG_FALSE;
+   p->fillArea = -1.0f;
+   p->strokeArea = -1.0f;
+   p->fillAreaCount = 0;
+   p->strokeAreaCount = 0;
+   p->meshFillRule = VG_EVEN_ODD;
+   p->meshValid = VG_FALSE;
+   p->meshUses = 0;
+
+   p->fillBuffer = 0;
+   p->strokeBuffer = 0;
+   p->meshBuffer = 0;
+   p->fillBufferSize = 0;
+   p->strokeBufferSize = 0;
+   p->meshBufferSize = 0;
+   p->fillBufferCount = 0;
+   p->strokeBufferCount = 0;
+   p->meshBufferCount = 0;
+
+   p->fillIndexBuffer = 0;
+   p->fillIndexBufferSize = 0;
+   p->fillIndexCount = 0;
+   p->fillIndicesValid = VG_FALSE;
+
+   p->cacheBucket = SH_PATH_LOD_NONE;
+   p->cacheRenderingQuality = VG_RENDERING_QUALITY_BETTER;
+   for (SHint i = 0; i < SH_PATH_LOD_COUNT; ++i)
+      SH_INITOBJ(SHPathLOD, p->lods[i]);
+   p->lodClock = 0;
 }
 
 /*-----------------------------------------------------
@@ -102,8 +137,211 @@ SHPath_dtor(SHPath * p)
    if (p->data)
       free(p->data);
 
-   SH_DEINITOBJ(SHVertexArray, p->vertices);
+   SH_DEINITOBJ(SHUint8Array, p->compiledSegs);
+   SH_DEINITOBJ(SHFloatArray, p->compiledData);
+   SH_DEINITOBJ(SHVector2Array, p->vertices);
+   SH_DEINITOBJ(SHUint8Array, p->vertexFlags);
+   SH_DEINITOBJ(SHIntArray, p->contours);
+   SH_DEINITOBJ(SHFloatArray, p->segmentLengths);
+   SH_DEINITOBJ(SHFloatArray, p->vertexLengths);
+   SH_DEINITOBJ(SHVector2Array, p->vertexTangents);
    SH_DEINITOBJ(SHVector2Array, p->stroke);
+   SH_DEINITOBJ(SHVector2Array, p->mesh);
+
+   if (p->fillBuffer)
+      glDeleteBuffers(1, &p->fillBuffer);
+   if (p->strokeBuffer)
+      glDeleteBuffers(1, &p->strokeBuffer);
+   if (p->meshBuffer)
+      glDeleteBuffers(1, &p->meshBuffer);
+   if (p->fillIndexBuffer)
+      glDeleteBuffers(1, &p->fillIndexBuffer);
+
+   for (SHint i = 0; i < SH_PATH_LOD_COUNT; ++i)
+      SH_DEINITOBJ(SHPathLOD, p->lods[i]);
+}
+
+/*-----------------------------------------------------
+ * Path recycler. Brings a path back to its constructed
+ * state but keeps the vertex and stroke buffers so the
+ * path can be reused from the context pool.
+ *-----------------------------------------------------*/
+
+void
+SHPath_recycle(SHPath * p)
+{
+   /* Raw data storage is kept unless huge. The next path
+      may use another datatype, so the data capacity is
+      counted in coordinates of the widest one */
+   if (p->segCapacity > SH_MAX_POOLED_ITEMS) {
+      free(p->segs);
+      p->segs = NULL;
+      p->segCapacity = 0;
+   }
+   if (p->dataCapacity > SH_MAX_POOLED_ITEMS) {
+      free(p->data);
+      p->data = NULL;
+      p->dataCapacity = 0;
+   }
+   p->dataCapacity = p->dataCapacity * shBytesPerDatatype[p->datatype] /
+                     SH_PATH_MAX_BYTES;
+
+   p->format = 0;
+   p->scale = 0.0f;
+   p->bias = 0.0f;
+   p->caps = 0;
+   p->datatype = VG_PATH_DATATYPE_F;
+
+   p->segCount = 0;
+   p->dataCount = 0;
+
+   /* Don't let a single huge path pin its buffers forever */
+   if (p->compiledSegs.capacity > SH_MAX_POOLED_ITEMS)
+      shUint8ArrayRealloc(&p->compiledSegs, 64);
+   if (p->compiledData.capacity > SH_MAX_POOLED_ITEMS)
+      shFloatArrayRealloc(&p->compiledData, 64);
+   if (p->vertices.capacity > SH_MAX_POOLED_ITEMS) {
+      shVector2ArrayRealloc(&p->vertices, 64);
+      shUint8ArrayRealloc(&p->vertexFlags, 64);
+   }
+   if (p->vertexLengths.capacity > SH_MAX_POOLED_ITEMS) {
+      shFloatArrayRealloc(&p->vertexLengths, 64);
+      shVector2ArrayRealloc(&p->vertexTangents, 64);
+   }
+   if (p->stroke.capacity > SH_MAX_POOLED_ITEMS)
+      shVector2ArrayRealloc(&p->stroke, 64);
+   if (p->mesh.capacity > SH_MAX_POOLED_ITEMS)
+      shVector2ArrayRealloc(&p->mesh, 64);
+
+   p->compiledSegs.size = 0;
+   p->compiledData.size = 0;
+   p->compiledValid = VG_FALSE;
+   p->segmentLengths.size = 0;
+   memset(&p->flattenEnd, 0, sizeof(SHPathCursor));
+   p->flattenValid = VG_FALSE;
+   p->vertices.size = 0;
+   p->vertexFlags.size = 0;
+   p->contours.size = 0;
+   p->measureValid = VG_FALSE;
+   p->stroke.size = 0;
+   memset(&p->strokeEnd, 0, sizeof(SHStrokeCursor));
+   p->mesh.size = 0;
+   p->convex = VG_FALSE;
+   p->fillArea = -1.0f;
+   p->strokeArea = -1.0f;
+   p->meshValid = VG_FALSE;
+   p->meshUses = 0;
+
+   /* GL buffers are kept too, only their contents are stale */
+   p->fillBufferCount = 0;
+   p->strokeBufferCount = 0;
+   p->meshBufferCount = 0;
+   p->fillIndicesValid = VG_FALSE;
+
+   /* Cached levels of detail keep their storage too */
+   for (SHint i = 0; i < SH_PATH_LOD_COUNT; ++i) {
+      SHPathLOD *l = &p->lods[i];
+      if (l->vertices.capacity > SH_MAX_POOLED_ITEMS) {
+         shVector2ArrayRealloc(&l->vertices, 64);
+         shUint8ArrayRealloc(&l->vertexFlags, 64);
+      }
+      if (l->mesh.capacity > SH_MAX_POOLED_ITEMS)
+         shVector2ArrayRealloc(&l->mesh, 64);
+      l->bucket = SH_PATH_LOD_NONE;
+      l->vertices.size = 0;
+      l->vertexFlags.size = 0;
+      l->contours.size = 0;
+      l->segmentLengths.size = 0;
+      l->mesh.size = 0;
+   }
+   p->cacheBucket = SH_PATH_LOD_NONE;
+}
+
+/*-----------------------------------------------------
+ * Cached level of detail constructor & destructor
+ *-----------------------------------------------------*/
+
+void
+SHPathLOD_ctor(SHPathLOD * l)
+{
+   l->bucket = SH_PATH_LOD_NONE;
+   l->lastUse = 0;
+
+   SH_INITOBJ(SHVector2Array, l->vertices);
+   SH_INITOBJ(SHUint8Array, l->vertexFlags);
+   SH_INITOBJ(SHIntArray, l->contours);
+   SET2(l->min, 0, 0);
+   SET2(l->max, 0, 0);
+   SH_INITOBJ(SHFloatArray, l->segmentLengths);
+   memset(&l->flattenEnd, 0, sizeof(SHPathCursor));
+   l->flattenTolerance = 0.0f;
+   l->convex = VG_FALSE;
+   l->fillBuffer = 0;
+   l->fillBufferSize = 0;
+   l->fillBufferCount = 0;
+
+   SH_INITOBJ(SHVector2Array, l->mesh);
+   l->meshFillRule = VG_EVEN_ODD;
+   l->meshValid = VG_FALSE;
+   l->meshUses = 0;
+   l->meshBuffer = 0;
+   l->meshBufferSize = 0;
+   l->meshBufferCount = 0;
+}
+
+void
+SHPathLOD_dtor(SHPathLOD * l)
+{
+   SH_DEINITOBJ(SHVector2Array, l->vertices);
+   SH_DEINITOBJ(SHUint8Array, l->vertexFlags);
+   SH_DEINITOBJ(SHIntArray, l->contours);
+   SH_DEINITOBJ(SHFloatArray, l->segmentLengths);
+   SH_DEINITOBJ(SHVector2Array, l->mesh);
+
+   if (l->fillBuffer)
+      glDeleteBuffers(1, &l->fillBuffer);
+   if (l->meshBuffer)
+      glDeleteBuffers(1, &l->meshBuffer);
+}
+
+/*-----------------------------------------------------
+ * Exchanges the current flattening of a path (with its
+ * triangulation and GL buffers) with a cached one. The
+ * data derived from the vertices that isn't cached is
+ * invalidated.
+ *-----------------------------------------------------*/
+
+#define SH_SWAP_FIELD(T, a, b) { T t = (a); (a) = (b); (b) = t; }
+
+void
+shSwapPathLOD(SHPath * p, SHPathLOD * l)
+{
+   SH_SWAP_FIELD(SHint, p->cacheBucket, l->bucket);
+   SH_SWAP_FIELD(SHVector2Array, p->vertices, l->vertices);
+   SH_SWAP_FIELD(SHUint8Array, p->vertexFlags, l->vertexFlags);
+   SH_SWAP_FIELD(SHIntArray, p->contours, l->contours);
+   SH_SWAP_FIELD(SHVector2, p->min, l->min);
+   SH_SWAP_FIELD(SHVector2, p->max, l->max);
+   SH_SWAP_FIELD(SHFloatArray, p->segmentLengths, l->segmentLengths);
+   SH_SWAP_FIELD(SHPathCursor, p->flattenEnd, l->flattenEnd);
+   SH_SWAP_FIELD(SHfloat, p->flattenTolerance, l->flattenTolerance);
+   SH_SWAP_FIELD(VGboolean, p->convex, l->convex);
+   SH_SWAP_FIELD(GLuint, p->fillBuffer, l->fillBuffer);
+   SH_SWAP_FIELD(GLsizeiptr, p->fillBufferSize, l->fillBufferSize);
+   SH_SWAP_FIELD(SHint, p->fillBufferCount, l->fillBufferCount);
+
+   SH_SWAP_FIELD(SHVector2Array, p->mesh, l->mesh);
+   SH_SWAP_FIELD(VGFillRule, p->meshFillRule, l->meshFillRule);
+   SH_SWAP_FIELD(VGboolean, p->meshValid, l->meshValid);
+   SH_SWAP_FIELD(SHint, p->meshUses, l->meshUses);
+   SH_SWAP_FIELD(GLuint, p->meshBuffer, l->meshBuffer);
+   SH_SWAP_FIELD(GLsizeiptr, p->meshBufferSize, l->meshBufferSize);
+   SH_SWAP_FIELD(SHint, p->meshBufferCount, l->meshBufferCount);
+
+   p->fillIndicesValid = VG_FALSE;
+   p->fillArea = -1.0f;
+   p->measureValid = VG_FALSE;
+   p->cacheStrokeTessValid = VG_FALSE;
 }
 
 /*-----------------------------------------------------
@@ -155,9 +393,14 @@ vgCreatePath(VGint pathFormat,
                     VG_ILLEGAL_ARGUMENT_ERROR, VG_INVALID_HANDLE);
 
    /* Allocate new resource */
-   SH_NEWOBJ(SHPath, p);
+   SH_NEWPOOLOBJ(SHPath, context->pathPool, p);
    VG_RETURN_ERR_IF(!p, VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
-   shPathArrayPushBack(&context->paths, p);
+
+   VGPath handle = shCreateHandle(context, p, SH_RESOURCE_PATH);
+   if (handle == VG_INVALID_HANDLE) {
+      SH_DELETEPOOLOBJ(SHPath, context->pathPool, p);
+      VG_RETURN_ERR(VG_OUT_OF_MEMORY_ERROR, VG_INVALID_HANDLE);
+   }
 
    /* Set parameters */
    p->format = pathFormat;
@@ -173,7 +416,7 @@ vgCreatePath(VGint pathFormat,
    p->cacheTransformInit = VG_FALSE;
    p->cacheStrokeInit = VG_FALSE;
 
-   VG_RETURN((VGPath) p);
+   VG_RETURN(handle);
 }
 
 /*-----------------------------------------------------
@@ -186,24 +429,27 @@ vgClearPath(VGPath path, VGbitfield capabilities)
 {
    SHPath *p = NULL;
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, path),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   /* Clear raw data */
-   p = (SHPath *) path;
-   free(p->segs);
-   free(p->data);
-   p->segs = NULL;
-   p->data = NULL;
+   /* Clear raw data. The storage is kept for the
+      data appended next */
+   p = shGetPath(context, path);
    p->segCount = 0;
    p->dataCount = 0;
 
    /* Mark change */
    p->cacheDataValid = VG_FALSE;
+   p->compiledValid = VG_FALSE;
+   p->flattenValid = VG_FALSE;
 
    /* Downsize arrays to save memory */
-   shVertexArrayRealloc(&p->vertices, 1);
+   shVector2ArrayRealloc(&p->vertices, 1);
+   shUint8ArrayRealloc(&p->vertexFlags, 1);
+   shIntArrayRealloc(&p->contours, 1);
+   p->measureValid = VG_FALSE;
    shVector2ArrayRealloc(&p->stroke, 1);
 
    /* Re-set capabilities */
@@ -219,16 +465,17 @@ vgClearPath(VGPath path, VGbitfield capabilities)
 VG_API_CALL void
 vgDestroyPath(VGPath path)
 {
-   int index;
+   SHPath *p;
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    /* Check if handle valid */
-   index = shPathArrayFind(&context->paths, (SHPath *) path);
-   VG_RETURN_ERR_IF(index == -1, VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
+   p = shGetPath(context, path);
+   VG_RETURN_ERR_IF(!p, VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
    /* Delete object and remove resource */
-   SH_DELETEOBJ(SHPath, (SHPath *) path);
-   shPathArrayRemoveAt(&context->paths, index);
+   SH_DELETEPOOLOBJ(SHPath, context->pathPool, p);
+   shReleaseHandle(context, path);
 
    VG_RETURN_ERR(VG_NO_ERROR, VG_NO_RETVAL);
 }
@@ -247,7 +494,7 @@ vgRemovePathCapabilities(VGPath path, VGbitfield capabilities)
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
    capabilities &= VG_PATH_CAPABILITY_ALL;
-   ((SHPath *) path)->caps &= ~capabilities;
+   shGetPath(context, path)->caps &= ~capabilities;
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -263,7 +510,7 @@ vgGetPathCapabilities(VGPath path)
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, path), VG_BAD_HANDLE_ERROR, 0x0);
 
-   VG_RETURN(((SHPath *) path)->caps);
+   VG_RETURN(shGetPath(context, path)->caps);
 }
 
 /*-----------------------------------------------------
@@ -313,6 +560,50 @@ shRealCoordFromData(VGPathDatatype type, SHfloat scale, SHfloat bias,
    }
 }
 
+/*-------------------------------------------------------
+ * Bulk decoders converting [count] coordinates of the
+ * path data starting at [start] to their final float
+ * interpretation, one generated per datatype.
+ *-------------------------------------------------------*/
+
+#define _COORD_T SHint8
+#define _FUNC_T  shDecodeCoordsS8
+#include "shDecodeBase.h"
+
+#define _COORD_T SHint16
+#define _FUNC_T  shDecodeCoordsS16
+#include "shDecodeBase.h"
+
+#define _COORD_T SHint32
+#define _FUNC_T  shDecodeCoordsS32
+#include "shDecodeBase.h"
+
+#define _COORD_T SHfloat32
+#define _FUNC_T  shDecodeCoordsF
+#include "shDecodeBase.h"
+
+static void
+shDecodeCoords(SHPath * restrict p, SHint start, SHint count,
+               SHfloat * restrict out)
+{
+   SH_ASSERT(p != NULL && out != NULL);
+
+   switch (p->datatype) {
+   case VG_PATH_DATATYPE_S_8:
+      shDecodeCoordsS8(p->data, start, count, p->scale, p->bias, out);
+      break;
+   case VG_PATH_DATATYPE_S_16:
+      shDecodeCoordsS16(p->data, start, count, p->scale, p->bias, out);
+      break;
+   case VG_PATH_DATATYPE_S_32:
+      shDecodeCoordsS32(p->data, start, count, p->scale, p->bias, out);
+      break;
+   default:
+      shDecodeCoordsF(p->data, start, count, p->scale, p->bias, out);
+      break;
+   }
+}
+
 /*-------------------------------------------------------
  * Interpretes the path data array according to the
  * path data type and sets the value at given index
@@ -358,61 +649,51 @@ shVertexPerCommand(SHPath *p, VGint seg)
    return shCoordsPerCommand[segindex];
 }
 
-/* -------------------------------------------------------
- * Extract from path the real coordinates of a given segment
- * (starting from a specific data position) and returns an
- * array with the coords
- *-------------------------------------------------------*/
-SHfloat *
-shRealCoordFromSegment(SHPath *p, VGint seg, VGint dataindex)
-{
-   SH_ASSERT(p != NULL);
-
-   /* Extract command */
-   SHuint  command = (p->segs[seg]);
-   SHuint  segment = (command & 0x1E);
-   SHint   segindex = (segment >> 1);
-   SHint   numcoords = shCoordsPerCommand[segindex];
-   SHfloat *coords = (SHfloat *) malloc(numcoords * sizeof(SHfloat));
-   for (SHint i = 0; i < numcoords; ++i) {
-      coords[i] = shRealCoordFromData(p->datatype, p->scale, p->bias, p->data, dataindex + i);
-   }
-   return coords;
-}
-
 /*-------------------------------------------------
- * Resizes storage for segment and coordinate data
- * of the specified path by given number of items
+ * Makes room for given number of segments and
+ * coordinates after the existing path data. The
+ * storage grows geometrically, starting from the
+ * capacity hints given at creation, so appending
+ * one segment at a time is amortized constant.
  *-------------------------------------------------*/
 
+static SHint
+shGrowCapacity(SHint capacity, SHint needed, SHint hint)
+{
+   if (needed <= capacity)
+      return capacity;
+   capacity = SH_MAX(capacity * 2, needed);
+   return SH_MAX(capacity, hint);
+}
+
 static int
-shResizePathData(SHPath * p, SHint newSegCount, SHint newDataCount,
-                 SHuint8 ** newSegs, SHuint8 ** newData)
+shReservePathData(SHPath * p, SHint newSegCount, SHint newDataCount)
 {
    SH_ASSERT(p != NULL);
 
-   SHint oldDataSize = 0;
-   SHint newDataSize = 0;
-
-   /* Allocate memory for new segments */
-   (*newSegs) = (SHuint8 *) malloc(p->segCount + newSegCount);
-   if ((*newSegs) == NULL)
-      return 0;
-
-   /* Allocate memory for new data */
-   oldDataSize = p->dataCount * shBytesPerDatatype[p->datatype];
-   newDataSize = newDataCount * shBytesPerDatatype[p->datatype];
-   (*newData) = (SHuint8 *) malloc(oldDataSize + newDataSize);
-   if ((*newData) == NULL) {
-      free(*newSegs);
-      return 0;
+   SHint segCapacity = shGrowCapacity(p->segCapacity,
+                                      p->segCount + newSegCount,
+                                      p->segHint);
+   SHint dataCapacity = shGrowCapacity(p->dataCapacity,
+                                       p->dataCount + newDataCount,
+                                       p->dataHint);
+
+   if (segCapacity > p->segCapacity) {
+      SHuint8 *segs = (SHuint8 *) SH_REALLOC(p->segs, segCapacity);
+      if (segs == NULL)
+         return 0;
+      p->segs = segs;
+      p->segCapacity = segCapacity;
    }
 
-   /* Copy old segments */
-   memcpy(*newSegs, p->segs, p->segCount);
-
-   /* Copy old data */
-   memcpy(*newData, p->data, oldDataSize);
+   if (dataCapacity > p->dataCapacity) {
+      void *data = SH_REALLOC(p->data, dataCapacity *
+                              shBytesPerDatatype[p->datatype]);
+      if (data == NULL)
+         return 0;
+      p->data = data;
+      p->dataCapacity = dataCapacity;
+   }
 
    return 1;
 }
@@ -427,26 +708,25 @@ vgAppendPath(VGPath dstPath, VGPath srcPath)
 {
    int i;
    SHPath *src, *dst;
-   SHuint8 *newSegs = NULL;
-   SHuint8 *newData = NULL;
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, srcPath) ||
                     !shIsValidPath(context, dstPath),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   src = (SHPath *) srcPath;
-   dst = (SHPath *) dstPath;
+   src = shGetPath(context, srcPath);
+   dst = shGetPath(context, dstPath);
    VG_RETURN_ERR_IF(!(src->caps & VG_PATH_CAPABILITY_APPEND_FROM) ||
                     !(dst->caps & VG_PATH_CAPABILITY_APPEND_TO),
                     VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
    /* Resize path storage */
-   shResizePathData(dst, src->segCount, src->dataCount, &newSegs, &newData);
-   VG_RETURN_ERR_IF(!newData, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
+   VG_RETURN_ERR_IF(!shReservePathData(dst, src->segCount, src->dataCount),
+                    VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    /* Copy new segments */
-   memcpy(newSegs + dst->segCount, src->segs, src->segCount);
+   memcpy(dst->segs + dst->segCount, src->segs, src->segCount);
 
    /* Copy new coordinates */
    for (i = 0; i < src->dataCount; ++i) {
@@ -455,21 +735,17 @@ vgAppendPath(VGPath dstPath, VGPath srcPath)
                                           src->bias, src->data, i);
 
       shRealCoordToData(dst->datatype, dst->scale, dst->bias,
-                        newData, dst->dataCount + i, coord);
+                        dst->data, dst->dataCount + i, coord);
    }
 
-   /* Free old arrays */
-   free(dst->segs);
-   free(dst->data);
-
    /* Adjust new properties */
-   dst->segs = newSegs;
-   dst->data = newData;
    dst->segCount += src->segCount;
    dst->dataCount += src->dataCount;
 
-   /* Mark change */
-   dst->cacheDataValid = VG_FALSE;
+   /* Mark change. The compiled stream and the tessellation
+      still match the data before the appended segments and
+      are only extended */
+   dst->flattenValid = VG_FALSE;
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -488,14 +764,13 @@ vgAppendPathData(VGPath dstPath, VGint newSegCount,
    SHint newDataCount = 0;
    SHint oldDataSize = 0;
    SHint newDataSize = 0;
-   SHuint8 *newSegs = NULL;
-   SHuint8 *newData = NULL;
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, dstPath),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   dst = (SHPath *) dstPath;
+   dst = shGetPath(context, dstPath);
    VG_RETURN_ERR_IF(!(dst->caps & VG_PATH_CAPABILITY_APPEND_TO),
                     VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
@@ -512,34 +787,30 @@ vgAppendPathData(VGPath dstPath, VGint newSegCount,
                     VG_NO_RETVAL);
 
    /* Resize path storage */
-   shResizePathData(dst, newSegCount, newDataCount, &newSegs, &newData);
-   VG_RETURN_ERR_IF(!newData, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
+   VG_RETURN_ERR_IF(!shReservePathData(dst, newSegCount, newDataCount),
+                    VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    /* Copy new segments */
-   memcpy(newSegs + dst->segCount, segs, newSegCount);
+   memcpy(dst->segs + dst->segCount, segs, newSegCount);
 
    /* Copy new coordinates */
    if (dst->datatype == VG_PATH_DATATYPE_F) {
       for (i = 0; i < newDataCount; ++i)
-         ((SHfloat32 *) newData)[dst->dataCount + i] =
+         ((SHfloat32 *) dst->data)[dst->dataCount + i] =
             shValidInputFloat(((VGfloat *) data)[i]);
    }
    else {
-      memcpy(newData + oldDataSize, data, newDataSize);
+      memcpy((SHuint8 *) dst->data + oldDataSize, data, newDataSize);
    }
 
-   /* Free old arrays */
-   free(dst->segs);
-   free(dst->data);
-
    /* Adjust new properties */
-   dst->segs = newSegs;
-   dst->data = newData;
    dst->segCount += newSegCount;
    dst->dataCount += newDataCount;
 
-   /* Mark change */
-   dst->cacheDataValid = VG_FALSE;
+   /* Mark change. The compiled stream and the tessellation
+      still match the data before the appended segments and
+      are only extended */
+   dst->flattenValid = VG_FALSE;
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -558,11 +829,12 @@ vgModifyPathCoords(VGPath dstPath, VGint startIndex,
    SHint dataStartCount;
    SHint dataStartSize;
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, dstPath),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   p = (SHPath *) dstPath;
+   p = shGetPath(context, dstPath);
    VG_RETURN_ERR_IF(!(p->caps & VG_PATH_CAPABILITY_MODIFY),
                     VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
@@ -591,6 +863,8 @@ vgModifyPathCoords(VGPath dstPath, VGint startIndex,
 
    /* Mark change */
    p->cacheDataValid = VG_FALSE;
+   p->compiledValid = VG_FALSE;
+   p->flattenValid = VG_FALSE;
 
    VG_RETURN(VG_NO_RETVAL);
 }
@@ -758,16 +1032,13 @@ shCentralizeArc(SHuint command, SHfloat * data)
  * processed data into another array, the given callback
  * function is called, so we don't need to walk the
  * raw data twice just to find the neccessary memory
- * size for processed data.
+ * size for processed data. Walking starts and ends at
+ * the given cursor, which keeps the pen state.
  *-------------------------------------------------------*/
 
-#define SH_PROCESS_SIMPLIFY_LINES    (1 << 0)
-#define SH_PROCESS_SIMPLIFY_CURVES   (1 << 1)
-#define SH_PROCESS_CENTRALIZE_ARCS   (1 << 2)
-#define SH_PROCESS_REPAIR_ENDS       (1 << 3)
-
-void
-shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
+static void
+shDecodePathData(SHPath * p, SHPathCursor * cursor, int flags,
+                 SegmentFunc callback, void *userData)
 {
    SHuint command;
    SHuint segment;
@@ -778,14 +1049,27 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
    SHVector2 start;             /* start of the current contour */
    SHVector2 pen;               /* current pen position */
    SHVector2 tan;               /* backward tangent for smoothing */
-   SHint open = 0;              /* contour-open flag */
+   SHint open;                  /* contour-open flag */
+   SHfloat *coords = NULL;      /* path data as floats */
+   SHint s, d;
+
+   /* Decode all the coordinates in one pass */
+   VGContext *context = shGetContext();
+   SHint first = cursor->data;
+   if (context != NULL && p->dataCount > first) {
+      coords = (SHfloat *) shArenaAlloc(&context->frameArena,
+                                        (p->dataCount - first) * sizeof(SHfloat));
+      if (coords != NULL)
+         shDecodeCoords(p, first, p->dataCount - first, coords);
+   }
 
-   /* Reset points */
-   SET2(start, 0, 0);
-   SET2(pen, 0, 0);
-   SET2(tan, 0, 0);
+   /* Restore points */
+   start = cursor->start;
+   pen = cursor->pen;
+   tan = cursor->tan;
+   open = cursor->open;
 
-   for (SHint s = 0, d = 0; s < p->segCount; ++s, d += numcoords) {
+   for (s = cursor->seg, d = first; s < p->segCount; ++s, d += numcoords) {
 
       /* Extract command */
       command = (p->segs[s]);
@@ -807,11 +1091,12 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
             data[1] = pen.y;
             data[2] = pen.x;
             data[3] = pen.y;
-            (*callback) (p, VG_MOVE_TO, command, data, userData);
+            (*callback) (p, s, VG_MOVE_TO, command, data, userData);
             open = 1;
          }
 
-         /* Avoid a MOVE_TO at the end of data */
+         /* Avoid a MOVE_TO at the end of data. It is
+            processed again if data gets appended */
          if (segment == VG_MOVE_TO) {
             if (s == p->segCount - 1)
                break;
@@ -831,8 +1116,11 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
       data[1] = pen.y;
 
       /* Unpack coordinates from path data */
-      for (SHint i = 0; i < numcoords; ++i) {
-         data[i + 2] = shRealCoordFromData(p->datatype, p->scale, p->bias, p->data, d + i);
+      if (coords != NULL) {
+         memcpy(&data[2], &coords[d - first], numcoords * sizeof(SHfloat));
+      } else {
+         for (SHint i = 0; i < numcoords; ++i)
+            data[i + 2] = shRealCoordFromData(p->datatype, p->scale, p->bias, p->data, d + i);
       }
 
       /* Simplify complex segments */
@@ -847,7 +1135,7 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
          SET2V(tan, start);
          open = 0;
 
-         (*callback) (p, VG_CLOSE_PATH, command, data, userData);
+         (*callback) (p, s, VG_CLOSE_PATH, command, data, userData);
 
          break;
       case VG_MOVE_TO:
@@ -863,7 +1151,7 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
          SET2V(tan, pen);
          open = 1;
 
-         (*callback) (p, VG_MOVE_TO, command, data, userData);
+         (*callback) (p, s, VG_MOVE_TO, command, data, userData);
 
          break;
       case VG_LINE_TO:
@@ -877,7 +1165,7 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
          SET2(pen, data[2], data[3]);
          SET2V(tan, pen);
 
-         (*callback) (p, VG_LINE_TO, command, data, userData);
+         (*callback) (p, s, VG_LINE_TO, command, data, userData);
 
          break;
       case VG_HLINE_TO:
@@ -891,11 +1179,11 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
 
          if (flags & SH_PROCESS_SIMPLIFY_LINES) {
             data[3] = pen.y;
-            (*callback) (p, VG_LINE_TO, command, data, userData);
+            (*callback) (p, s, VG_LINE_TO, command, data, userData);
             break;
          }
 
-         (*callback) (p, VG_HLINE_TO, command, data, userData);
+         (*callback) (p, s, VG_HLINE_TO, command, data, userData);
 
          break;
       case VG_VLINE_TO:
@@ -910,11 +1198,11 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
          if (flags & SH_PROCESS_SIMPLIFY_LINES) {
             data[2] = pen.x;
             data[3] = pen.y;
-            (*callback) (p, VG_LINE_TO, command, data, userData);
+            (*callback) (p, s, VG_LINE_TO, command, data, userData);
             break;
          }
 
-         (*callback) (p, VG_VLINE_TO, command, data, userData);
+         (*callback) (p, s, VG_VLINE_TO, command, data, userData);
 
          break;
       case VG_QUAD_TO:
@@ -930,7 +1218,7 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
          SET2(tan, data[2], data[3]);
          SET2(pen, data[4], data[5]);
 
-         (*callback) (p, VG_QUAD_TO, command, data, userData);
+         (*callback) (p, s, VG_QUAD_TO, command, data, userData);
 
          break;
       case VG_CUBIC_TO:
@@ -948,7 +1236,7 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
          SET2(tan, data[4], data[5]);
          SET2(pen, data[6], data[7]);
 
-         (*callback) (p, VG_CUBIC_TO, command, data, userData);
+         (*callback) (p, s, VG_CUBIC_TO, command, data, userData);
 
          break;
       case VG_SQUAD_TO:
@@ -967,11 +1255,11 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
             data[3] = tan.y;
             data[4] = pen.x;
             data[5] = pen.y;
-            (*callback) (p, VG_QUAD_TO, command, data, userData);
+            (*callback) (p, s, VG_QUAD_TO, command, data, userData);
             break;
          }
 
-         (*callback) (p, VG_SQUAD_TO, command, data, userData);
+         (*callback) (p, s, VG_SQUAD_TO, command, data, userData);
 
          break;
       case VG_SCUBIC_TO:
@@ -994,11 +1282,11 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
             data[5] = tan.y;
             data[6] = pen.x;
             data[7] = pen.y;
-            (*callback) (p, VG_CUBIC_TO, command, data, userData);
+            (*callback) (p, s, VG_CUBIC_TO, command, data, userData);
             break;
          }
 
-         (*callback) (p, VG_SCUBIC_TO, command, data, userData);
+         (*callback) (p, s, VG_SCUBIC_TO, command, data, userData);
 
          break;
       case VG_SCWARC_TO:
@@ -1020,17 +1308,177 @@ shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
 
          if (flags & SH_PROCESS_CENTRALIZE_ARCS) {
             if (shCentralizeArc(command, data))
-               (*callback) (p, segment, command, data, userData);
+               (*callback) (p, s, segment, command, data, userData);
             else
-               (*callback) (p, VG_LINE_TO, command, data, userData);
+               (*callback) (p, s, VG_LINE_TO, command, data, userData);
             break;
          }
 
-         (*callback) (p, segment, command, data, userData);
+         (*callback) (p, s, segment, command, data, userData);
          break;
 
       }                         /* switch (command) */
    }                            /* for each segment */
+
+   cursor->seg = s;
+   cursor->data = d;
+   cursor->start = start;
+   cursor->pen = pen;
+   cursor->tan = tan;
+   cursor->open = open;
+}
+
+/*-------------------------------------------------------
+ * Compiled segment stream. Decoding the raw data means
+ * converting datatypes and relative coordinates, and
+ * centralizing arcs with plenty of trigonometry, so the
+ * fully simplified stream is recorded once and replayed
+ * until the path data changes. Each record is the
+ * segment, its original command and the data passed to
+ * the callback, whose size depends only on the segment.
+ * Repairing ends is done on replay, since it only needs
+ * the pen position that opens every record. Appended
+ * data is compiled from where the stream ended.
+ *-------------------------------------------------------*/
+
+#define SH_PROCESS_COMPILED_FLAGS \
+   (SH_PROCESS_SIMPLIFY_LINES | SH_PROCESS_SIMPLIFY_CURVES | \
+    SH_PROCESS_CENTRALIZE_ARCS)
+
+static SHint
+shCompiledDataSize(SHuint segment)
+{
+   switch (segment) {
+   case VG_QUAD_TO:
+      return 6;
+   case VG_CUBIC_TO:
+      return 8;
+   case VG_SCWARC_TO:
+   case VG_SCCWARC_TO:
+   case VG_LCWARC_TO:
+   case VG_LCCWARC_TO:
+      return 12;
+   default:
+      return 4;
+   }
+}
+
+static void
+shCompileSegment(SHPath * p, SHint index, VGPathSegment segment,
+                 VGPathCommand originalCommand,
+                 SHfloat * data, void *userData)
+{
+   shUint8ArrayPushBack(&p->compiledSegs, (SHuint8) segment);
+   shUint8ArrayPushBack(&p->compiledSegs, (SHuint8) originalCommand);
+   for (SHint i = 0, n = shCompiledDataSize(segment); i < n; ++i)
+      shFloatArrayPushBack(&p->compiledData, data[i]);
+}
+
+static void
+shCompilePath(SHPath * p)
+{
+   if (!p->compiledValid) {
+      p->compiledSegs.size = 0;
+      p->compiledData.size = 0;
+      memset(&p->compiledEnd, 0, sizeof(SHPathCursor));
+      p->compiledValid = VG_TRUE;
+   }
+
+   if (p->compiledEnd.seg == p->segCount)
+      return;
+
+   /* Grow geometrically as data gets appended */
+   if (2 * p->segCount > p->compiledSegs.capacity)
+      shUint8ArrayReserveAndCopy(&p->compiledSegs,
+                                 SH_MAX(2 * p->segCount,
+                                        2 * p->compiledSegs.capacity));
+   if (2 * p->dataCount + 4 > p->compiledData.capacity)
+      shFloatArrayReserveAndCopy(&p->compiledData,
+                                 SH_MAX(2 * p->dataCount + 4,
+                                        2 * p->compiledData.capacity));
+
+   shDecodePathData(p, &p->compiledEnd, SH_PROCESS_COMPILED_FLAGS,
+                    shCompileSegment, NULL);
+}
+
+void
+shProcessPathData(SHPath * p, int flags, SegmentFunc callback, void *userData)
+{
+   SHPathCursor cursor;
+
+   memset(&cursor, 0, sizeof(SHPathCursor));
+   shProcessPathTail(p, &cursor, flags, callback, userData);
+}
+
+void
+shProcessPathTail(SHPath * p, SHPathCursor * cursor, int flags,
+                  SegmentFunc callback, void *userData)
+{
+   SHfloat data[SH_PATH_MAX_COORDS_PROCESSED];
+   SHint open = cursor->open;
+   SHint s;
+
+   /* Other simplifications (vgTransformPath and
+      vgInterpolatePath keep some segment kinds) decode
+      the raw data directly */
+   if ((flags & ~SH_PROCESS_REPAIR_ENDS) != SH_PROCESS_COMPILED_FLAGS) {
+      shDecodePathData(p, cursor, flags, callback, userData);
+      return;
+   }
+
+   shCompilePath(p);
+
+   SHint count = p->compiledSegs.size / 2;
+   const SHuint8 *segs = p->compiledSegs.items;
+   const SHfloat *src = p->compiledData.items + cursor->data;
+
+   for (s = cursor->seg; s < count; ++s) {
+      SHuint segment = segs[2 * s];
+      SHuint command = segs[2 * s + 1];
+      SHint n = shCompiledDataSize(segment);
+
+      memcpy(data, src, n * sizeof(SHfloat));
+      src += n;
+
+      if (flags & SH_PROCESS_REPAIR_ENDS) {
+
+         /* Prevent double CLOSE_PATH */
+         if (!open && segment == VG_CLOSE_PATH)
+            continue;
+
+         /* Implicit MOVE_TO if segment starts without */
+         if (!open && segment != VG_MOVE_TO) {
+            SHfloat move[4] = { data[0], data[1], data[0], data[1] };
+            (*callback) (p, s, VG_MOVE_TO, command, move, userData);
+            open = 1;
+         }
+
+         /* Avoid a MOVE_TO at the end of data or a lone MOVE_TO.
+            The cursor stays before the former one */
+         if (segment == VG_MOVE_TO) {
+            if (s == count - 1) {
+               src -= n;
+               break;
+            }
+            if (segs[2 * (s + 1)] == VG_MOVE_TO) {
+               open = 0;
+               continue;
+            }
+         }
+
+         if (segment == VG_MOVE_TO)
+            open = 1;
+         else if (segment == VG_CLOSE_PATH)
+            open = 0;
+      }
+
+      (*callback) (p, s, (VGPathSegment) segment, (VGPathCommand) command,
+                   data, userData);
+   }
+
+   cursor->seg = s;
+   cursor->data = src - p->compiledData.items;
+   cursor->open = open;
 }
 
 /*-------------------------------------------------------
@@ -1098,7 +1546,7 @@ shProcessedDataCount(SHPath * p, SHint flags,
 }
 
 static void
-shTransformSegment(SHPath * p, VGPathSegment segment,
+shTransformSegment(SHPath * p, SHint index, VGPathSegment segment,
                    VGPathCommand originalCommand,
                    SHfloat * data, void *userData)
 {
@@ -1112,7 +1560,7 @@ shTransformSegment(SHPath * p, VGPathSegment segment,
    SHMatrix3x3 *ctm;
 
    /* Get current transform matrix */
-   VG_GETCONTEXT(VG_NO_RETVAL);
+   SH_GETCONTEXT(VG_NO_RETVAL);
    ctm = &context->pathTransform;
 
    switch (segment) {
@@ -1273,58 +1721,53 @@ vgTransformPath(VGPath dstPath, VGPath srcPath)
    SHint newSegCount = 0;
    SHint newDataCount = 0;
    SHPath *src, *dst;
-   SHuint8 *newSegs = NULL;
-   SHuint8 *newData = NULL;
    SHint segCount = 0;
    SHint dataCount = 0;
    void *userData[5];
    SHint processFlags = SH_PROCESS_SIMPLIFY_LINES;
 
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, dstPath) ||
                     !shIsValidPath(context, srcPath),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
 
-   src = (SHPath *) srcPath;
-   dst = (SHPath *) dstPath;
+   src = shGetPath(context, srcPath);
+   dst = shGetPath(context, dstPath);
    VG_RETURN_ERR_IF(!(src->caps & VG_PATH_CAPABILITY_TRANSFORM_FROM) ||
                     !(dst->caps & VG_PATH_CAPABILITY_TRANSFORM_TO),
                     VG_PATH_CAPABILITY_ERROR, VG_NO_RETVAL);
 
    /* Resize path storage */
    shProcessedDataCount(src, processFlags, &newSegCount, &newDataCount);
-   shResizePathData(dst, newSegCount, newDataCount, &newSegs, &newData);
-   VG_RETURN_ERR_IF(!newData, VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
+   VG_RETURN_ERR_IF(!shReservePathData(dst, newSegCount, newDataCount),
+                    VG_OUT_OF_MEMORY_ERROR, VG_NO_RETVAL);
 
    /* Transform src path into new data */
    segCount = dst->segCount;
    dataCount = dst->dataCount;
-   userData[0] = newSegs;
+   userData[0] = dst->segs;
    userData[1] = &segCount;
-   userData[2] = newData;
+   userData[2] = dst->data;
    userData[3] = &dataCount;
    userData[4] = dst;
    shProcessPathData(src, processFlags, shTransformSegment, userData);
 
-   /* Free old arrays */
-   free(dst->segs);
-   free(dst->data);
-
    /* Adjust new properties */
-   dst->segs = newSegs;
-   dst->data = newData;
    dst->segCount = segCount;
    dst->dataCount = dataCount;
 
    /* Mark change */
    dst->cacheDataValid = VG_FALSE;
+   dst->compiledValid = VG_FALSE;
+   dst->flattenValid = VG_FALSE;
 
    VG_RETURN_ERR(VG_NO_ERROR, VG_NO_RETVAL);
 }
 
 static void
-shInterpolateSegment(SHPath * p, VGPathSegment segment,
+shInterpolateSegment(SHPath * p, SHint index, VGPathSegment segment,
                      VGPathCommand originalCommand,
                      SHfloat * data, void *userData)
 {
@@ -1352,22 +1795,22 @@ vgInterpolatePath(VGPath dstPath, VGPath startPath,
    SHfloat *procData1, *procData2;
    SHint procSegCount1 = 0, procSegCount2 = 0;
    SHint procDataCount1 = 0, procDataCount2 = 0;
-   SHuint8 *newSegs, *newData;
    void *userData[4];
    SHint segment1, segment2;
    SHint segindex;
    SHint processFlags = SH_PROCESS_SIMPLIFY_LINES | SH_PROCESS_SIMPLIFY_CURVES;
 
    VG_GETCONTEXT(VG_FALSE);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidPath(context, dstPath) ||
                     !shIsValidPath(context, startPath) ||
                     !shIsValidPath(context, endPath),
                     VG_BAD_HANDLE_ERROR, VG_FALSE);
 
-   dst = (SHPath *) dstPath;
-   start = (SHPath *) startPath;
-   end = (SHPath *) endPath;
+   dst = shGetPath(context, dstPath);
+   start = shGetPath(context, startPath);
+   end = shGetPath(context, endPath);
    VG_RETURN_ERR_IF(!(start->caps & VG_PATH_CAPABILITY_INTERPOLATE_FROM) ||
                     !(end->caps & VG_PATH_CAPABILITY_INTERPOLATE_FROM) ||
                     !(dst->caps & VG_PATH_CAPABILITY_INTERPOLATE_TO),
@@ -1380,26 +1823,22 @@ vgInterpolatePath(VGPath dstPath, VGPath startPath,
    shProcessedDataCount(start, processFlags, &procSegCount1, &procDataCount1);
    shProcessedDataCount(end, processFlags, &procSegCount2, &procDataCount2);
    if (procSegCount1 > 0) {     // prevent allocation of 0 bytes (CERT MEM04-C)
-      procSegs1 = (SHuint8 *) malloc(procSegCount1 * sizeof(SHuint8));
-      procData1 = (SHfloat *) malloc(procDataCount1 * sizeof(SHfloat));
+      procSegs1 = (SHuint8 *) shArenaAlloc(&context->frameArena, procSegCount1 * sizeof(SHuint8));
+      procData1 = (SHfloat *) shArenaAlloc(&context->frameArena, procDataCount1 * sizeof(SHfloat));
    }
    else {
       procSegs1 = NULL;
       procData1 = NULL;
    }
    if (procSegCount2 > 0) {
-      procSegs2 = (SHuint8 *) malloc(procSegCount2 * sizeof(SHuint8));
-      procData2 = (SHfloat *) malloc(procDataCount2 * sizeof(SHfloat));
+      procSegs2 = (SHuint8 *) shArenaAlloc(&context->frameArena, procSegCount2 * sizeof(SHuint8));
+      procData2 = (SHfloat *) shArenaAlloc(&context->frameArena, procDataCount2 * sizeof(SHfloat));
    }
    else {
       procSegs2 = NULL;
       procData2 = NULL;
    }
    if (!procSegs1 || !procSegs2 || !procData1 || !procData2) {
-      free(procSegs1);
-      free(procSegs2);
-      free(procData1);
-      free(procData2);
       VG_RETURN_ERR(VG_OUT_OF_MEMORY_ERROR, VG_FALSE);
    }
 
@@ -1424,12 +1863,7 @@ vgInterpolatePath(VGPath dstPath, VGPath startPath,
              procDataCount1 == procDataCount2);
 
    /* Resize dst path storage to include interpolated data */
-   shResizePathData(dst, procSegCount1, procDataCount1, &newSegs, &newData);
-   if (!newData) {
-      free(procSegs1);
-      free(procData1);
-      free(procSegs2);
-      free(procData2);
+   if (!shReservePathData(dst, procSegCount1, procDataCount1)) {
       VG_RETURN_ERR(VG_OUT_OF_MEMORY_ERROR, VG_FALSE);
    }
 
@@ -1448,42 +1882,31 @@ vgInterpolatePath(VGPath dstPath, VGPath startPath,
             segment1 = segment2;
       }
 
-      /* Segment types must match */
+      /* Segment types must match. Whatever was written past
+         the end of dst is dropped, since its counts are kept */
       if (segment1 != segment2) {
-         free(procSegs1);
-         free(procData1);
-         free(procSegs2);
-         free(procData2);
-         free(newSegs);
-         free(newData);
          VG_RETURN_ERR(VG_NO_ERROR, VG_FALSE);
       }
 
       /* Interpolate values */
       segindex = (segment1 >> 1);
-      newSegs[s] = segment1 | VG_ABSOLUTE;
+      dst->segs[dst->segCount + s] = segment1 | VG_ABSOLUTE;
       for (SHint i = 0; i < shCoordsPerCommand[segindex]; ++i, ++d) {
          SHfloat diff = procData2[d] - procData1[d];
          SHfloat value = procData1[d] + amount * diff;
          shRealCoordToData(dst->datatype, dst->scale, dst->bias,
-                           newData, dst->dataCount + d, value);
+                           dst->data, dst->dataCount + d, value);
       }
    }
 
-   /* Free processed data */
-   free(procSegs1);
-   free(procData1);
-   free(procSegs2);
-   free(procData2);
-
    /* Assign interpolated data */
-   dst->segs = newSegs;
-   dst->data = newData;
    dst->segCount += procSegCount1;
    dst->dataCount += procDataCount1;
 
    /* Mark change */
    dst->cacheDataValid = VG_FALSE;
+   dst->compiledValid = VG_FALSE;
+   dst->flattenValid = VG_FALSE;
 
    VG_RETURN_ERR(VG_NO_ERROR, VG_TRUE);
 }
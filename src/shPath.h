@@ -48,28 +48,77 @@ typedef struct
    SHfloat a2;
 } SHArc;
 
-/* SHVertex */
-typedef struct
-{
-   SHVector2 point;
-   SHVector2 tangent;
-   SHfloat length;
-   SHuint flags;
-
-} SHVertex;
-
 /* Vertex flags for contour definition */
 #define SH_VERTEX_FLAG_CLOSE   (1 << 0)
 #define SH_VERTEX_FLAG_SEGEND  (1 << 1)
 #define SH_SEGMENT_TYPE_COUNT  13
 
-/* Vertex array */
-#define _ITEM_T SHVertex
-#define _ARRAY_T SHVertexArray
-#define _FUNC_T shVertexArray
-#define _ARRAY_DECLARE
-#include "shArrayBase.h"
+/* Position reached by processing path data, from where
+   data appended afterwards is processed. [data] counts
+   the coordinates consumed, or the compiled floats when
+   the compiled stream is replayed */
+typedef struct
+{
+   SHint seg;
+   SHint data;
+   SHVector2 start;
+   SHVector2 pen;
+   SHVector2 tan;
+   SHint open;
 
+} SHPathCursor;
+
+/* Position stroking can be resumed from when the last
+   contour grows: the edge ending it, the stroke size, the
+   previous edge and the dash state before it. [vertices]
+   is the number of vertices stroked */
+typedef struct
+{
+   SHint vertices;
+   SHint vertex;
+   SHint contour;
+   SHint contourStart;
+   SHint strokeSize;
+   SHVector2 lprev, rprev, dprev, tprev;
+   SHint dashIndex, dashOn;
+   SHfloat dashLength, strokeLength;
+
+} SHStrokeCursor;
+
+/* A cached flattening of a path for one scale bucket,
+   swapped in and out of the path's current fields */
+#define SH_PATH_LOD_COUNT  3
+#define SH_PATH_LOD_NONE   0x7fffffff
+
+typedef struct
+{
+   SHint bucket;
+   SHuint lastUse;
+
+   SHVector2Array vertices;
+   SHUint8Array vertexFlags;
+   SHIntArray contours;
+   SHVector2 min, max;
+   SHFloatArray segmentLengths;
+   SHPathCursor flattenEnd;
+   SHfloat flattenTolerance;
+   VGboolean convex;
+   GLuint fillBuffer;
+   GLsizeiptr fillBufferSize;
+   SHint fillBufferCount;
+
+   SHVector2Array mesh;
+   VGFillRule meshFillRule;
+   VGboolean meshValid;
+   SHint meshUses;
+   GLuint meshBuffer;
+   GLsizeiptr meshBufferSize;
+   SHint meshBufferCount;
+
+} SHPathLOD;
+
+void SHPathLOD_ctor(SHPathLOD * l);
+void SHPathLOD_dtor(SHPathLOD * l);
 
 /* SHPath */
 typedef struct SHPath
@@ -83,25 +132,101 @@ typedef struct SHPath
    VGbitfield caps;
    VGPathDatatype datatype;
 
-   /* Raw data */
+   /* Raw data. Capacities are in segments and coordinates */
    SHuint8 *segs;
    void *data;
    SHint segCount;
    SHint dataCount;
+   SHint segCapacity;
+   SHint dataCapacity;
 
-   /* Subdivision */
-   SHVertexArray vertices;
+   /* Compiled segment stream: simplified absolute float
+      segments recorded from the raw data, two bytes
+      (segment, original command) per record */
+   SHUint8Array compiledSegs;
+   SHFloatArray compiledData;
+   SHPathCursor compiledEnd;
+   VGboolean compiledValid;
+
+   /* Subdivision, with the path length up to the end of
+      each raw segment. Valid for the current path data
+      when flattenValid is set. The points are packed for
+      upload, with their flags and the vertex count of
+      each contour kept in arrays of their own. Data
+      appended after flattenEnd is flattened on its own */
+   SHVector2Array vertices;
+   SHUint8Array vertexFlags;
+   SHIntArray contours;
    SHVector2 min, max;
+   SHFloatArray segmentLengths;
+   SHPathCursor flattenEnd;
+   SHfloat flattenTolerance;
+   VGboolean flattenValid;
+   VGboolean convex;
+
+   /* Running length and unit tangent at each vertex, only
+      measured for the point and tangent along path queries */
+   SHFloatArray vertexLengths;
+   SHVector2Array vertexTangents;
+   VGboolean measureValid;
 
    /* Additional stroke geometry (dash vertices if
       path dashed or triangle vertices if width > 1 */
    SHVector2Array stroke;
+   SHStrokeCursor strokeEnd;
+
+   /* Area rasterized by the fill fans and stroke triangles
+      in user space, used to pick the cover geometry, and
+      the number of vertices it was measured over. A
+      negative value means it has to be measured again */
+   SHfloat fillArea;
+   SHfloat strokeArea;
+   SHint fillAreaCount;
+   SHint strokeAreaCount;
+
+   /* Triangulated fill of the vertices for meshFillRule.
+      meshUses counts fills since the last flattening,
+      -1 if the path could not be triangulated */
+   SHVector2Array mesh;
+   VGFillRule meshFillRule;
+   VGboolean meshValid;
+   SHint meshUses;
+
+   /* GL buffer objects mirroring the vertices, stroke and
+      mesh arrays, with the number of items already
+      uploaded. Only items added since are uploaded, zero
+      re-uploads everything after an array is rebuilt */
+   GLuint fillBuffer;
+   GLuint strokeBuffer;
+   GLuint meshBuffer;
+   GLsizeiptr fillBufferSize;
+   GLsizeiptr strokeBufferSize;
+   GLsizeiptr meshBufferSize;
+   SHint fillBufferCount;
+   SHint strokeBufferCount;
+   SHint meshBufferCount;
+
+   /* Element buffer joining the contours of the vertices
+      with restart indices, rebuilt when they are flattened */
+   GLuint fillIndexBuffer;
+   GLsizeiptr fillIndexBufferSize;
+   GLsizei fillIndexCount;
+   VGboolean fillIndicesValid;
 
    /* Cache */
    VGboolean cacheDataValid;
 
+   /* Vertices are flattened in user space for the power
+      of two bucket of the path transform's maximum scale.
+      Other recently used buckets are kept in lods */
    VGboolean cacheTransformInit;
-   SHMatrix3x3 cacheTransform;
+   SHint cacheBucket;
+   SHPathLOD lods[SH_PATH_LOD_COUNT];
+   SHuint lodClock;
+
+   /* Rendering quality the vertices were flattened for,
+      simplified unless it is VG_RENDERING_QUALITY_BETTER */
+   VGRenderingQuality cacheRenderingQuality;
 
    VGboolean cacheStrokeInit;
    VGboolean cacheStrokeTessValid;
@@ -116,6 +241,8 @@ typedef struct SHPath
 
 void SHPath_ctor(SHPath * p);
 void SHPath_dtor(SHPath * p);
+void SHPath_recycle(SHPath * p);
+void shSwapPathLOD(SHPath * p, SHPathLOD * l);
 
 
 /* Processing normalization flags */
@@ -124,8 +251,10 @@ void SHPath_dtor(SHPath * p);
 #define SH_PROCESS_CENTRALIZE_ARCS   (1 << 2)
 #define SH_PROCESS_REPAIR_ENDS       (1 << 3)
 
-/* Segment callback function type */
-typedef void (*SegmentFunc) (SHPath * p, VGPathSegment segment,
+/* Segment callback function type. Index is the raw
+   segment the processed segment comes from */
+typedef void (*SegmentFunc) (SHPath * p, SHint index,
+                             VGPathSegment segment,
                              VGPathCommand originalCommand,
                              SHfloat * data, void *userData);
 
@@ -133,11 +262,10 @@ typedef void (*SegmentFunc) (SHPath * p, VGPathSegment segment,
 void shProcessPathData(SHPath * p, int flags,
                        SegmentFunc callback, void *userData);
 
-// TODO: se questa non serve in altri posti forse è meglio metterla direttamente dentro shGeometry
-/* Return the real coordinates of a given segment starting from a dataindex position */
-SHfloat *
-shRealCoordFromSegment(SHPath *p, VGint seg, VGint dataindex);
-
+/* Processes the path data after the cursor and moves the
+   cursor to the end of what was processed */
+void shProcessPathTail(SHPath * p, SHPathCursor * cursor, int flags,
+                       SegmentFunc callback, void *userData);
 
 /* Return the number of vertex of a command */
 SHint
@@ -147,11 +275,4 @@ shVertexPerCommand(SHPath *p, VGint seg);
 SHint
 shCoordCountForData(VGint segcount, const SHuint8 * segs);
 
-/* Pointer-to-path array */
-#define _ITEM_T SHPath*
-#define _ARRAY_T SHPathArray
-#define _FUNC_T shPathArray
-#define _ARRAY_DECLARE
-#include "shArrayBase.h"
-
 #endif /* __SHPATH_H */
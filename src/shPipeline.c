@@ -19,6 +19,7 @@
  */
 
 #define VG_API_EXPORT
+#include <stddef.h>
 #include <VG/openvg.h>
 #include "shDefs.h"
 // #include "shExtensions.h"
@@ -28,6 +29,14 @@
 #include "shGeometry.h"
 #include "shPaint.h"
 #include "shCommons.h"
+#include <string.h>
+
+#define _ITEM_T SHDrawCommand
+#define _ARRAY_T SHDrawCommandArray
+#define _FUNC_T shDrawCommandArray
+#define _COMPARE_T(c1,c2) 0
+#define _ARRAY_DEFINE
+#include "shArrayBase.h"
 
 // A mat4 identity matrix
 // static SHfloat migu[16] = {1.0,0,0,0 ,0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0};
@@ -258,6 +267,43 @@ updateBlendingStateGL(VGContext * restrict c, int alphaIsOne)
 
 }
 
+/*-----------------------------------------------------------
+ * Binds a path's GL buffer, uploading the items of its
+ * array added since [count] were uploaded. The storage is
+ * only reallocated when the data outgrows it, doubling so
+ * a growing path doesn't upload everything every time.
+ * Callers rebind 0 after drawing since the other draw
+ * helpers source client-side arrays.
+ *-----------------------------------------------------------*/
+
+static void
+shBindPathBuffer(GLuint * buffer, GLsizeiptr * bufferSize, SHint * count,
+                 const void *data, SHint size, GLsizeiptr itemSize)
+{
+   if (*buffer == 0)
+      glGenBuffers(1, buffer);
+
+   glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+
+   if (*count == size)
+      return;
+   if (*count > size)
+      *count = 0;
+
+   if (size * itemSize > *bufferSize) {
+      GLsizeiptr capacity = (*count > 0 ? SH_MAX(size * itemSize, 2 * *bufferSize)
+                                         : size * itemSize);
+      glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+      *bufferSize = capacity;
+      *count = 0;
+   }
+
+   glBufferSubData(GL_ARRAY_BUFFER, *count * itemSize,
+                   (size - *count) * itemSize,
+                   (const SHuint8 *) data + *count * itemSize);
+   *count = size;
+}
+
 /*-----------------------------------------------------------
  * Draws the triangles representing the stroke of a path.
  *-----------------------------------------------------------*/
@@ -266,68 +312,126 @@ static inline void
 shDrawStroke(SHPath * restrict p)
 {
    SH_ASSERT(p != NULL);
-//   glEnableClientState(GL_VERTEX_ARRAY);
-//   glVertexPointer(2, GL_FLOAT, 0, p->stroke.items);
-   glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0,
-                         (GLfloat *) p->stroke.items);
+   shBindPathBuffer(&p->strokeBuffer, &p->strokeBufferSize,
+                    &p->strokeBufferCount, p->stroke.items,
+                    p->stroke.size, sizeof(SHVector2));
+   glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0, NULL);
    glEnableVertexAttribArray(position_loc);
    glDrawArrays(GL_TRIANGLES, 0, p->stroke.size);
    glDisableVertexAttribArray(position_loc);
-//   glDisableClientState(GL_VERTEX_ARRAY);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 
 /*-----------------------------------------------------------
- * Draws the subdivided vertices in the OpenGL mode given
- * (this could be VG_TRIANGLE_FAN or VG_LINE_STRIP).
+ * Draws the triangulated fill of a path.
  *-----------------------------------------------------------*/
 
-static void
-shDrawVertices(SHPath * restrict p, GLenum mode)
+static inline void
+shDrawMesh(SHPath * restrict p)
 {
    SH_ASSERT(p != NULL);
-   /* We separate vertex arrays by contours to properly
-      handle the fill modes */
-//   glEnableClientState(GL_VERTEX_ARRAY);
-   glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, sizeof(SHVertex),
-                         p->vertices.items);
+   shBindPathBuffer(&p->meshBuffer, &p->meshBufferSize,
+                    &p->meshBufferCount, p->mesh.items,
+                    p->mesh.size, sizeof(SHVector2));
+   glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0, NULL);
    glEnableVertexAttribArray(position_loc);
-
-   SHint start = 0;
-   SHint size = 0;
-   while (start < p->vertices.size) {
-      size = p->vertices.items[start].flags;
-      glDrawArrays(mode, start, size);
-      start += size;
-   }
+   glDrawArrays(GL_TRIANGLES, 0, p->mesh.size);
    glDisableVertexAttribArray(position_loc);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+/*-----------------------------------------------------------
+ * Draws the subdivided vertices in the OpenGL mode given
+ * (this could be VG_TRIANGLE_FAN or VG_LINE_STRIP).
+ *-----------------------------------------------------------*/
 
-/*-------------------------------------------------------------
- * Draw a single quad that covers the bounding box of a path
- *-------------------------------------------------------------*/
-
-static void
-shDrawBoundBox(VGContext * restrict c, SHPath * restrict p, VGPaintMode mode)
+static VGboolean
+shBindPathIndices(SHPath * restrict p)
 {
-   SH_ASSERT(c != NULL && p != NULL);
-   SHfloat K = 1.0f;
-   if (mode == VG_STROKE_PATH) {
-      K = SH_CEIL(c->strokeMiterLimit * c->strokeLineWidth) + 1.0f;
+   if (p->fillIndexBuffer == 0)
+      glGenBuffers(1, &p->fillIndexBuffer);
+
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p->fillIndexBuffer);
+
+   if (p->fillIndicesValid)
+      return VG_TRUE;
+
+   /* One index per vertex plus a restart between contours */
+   SHint count = p->vertices.size + p->contours.size - 1;
+
+   GLsizeiptr size = count * sizeof(GLuint);
+   if (size > p->fillIndexBufferSize) {
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+      p->fillIndexBufferSize = size;
+   }
+
+   GLuint *idx = (GLuint *) glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, size,
+                                             GL_MAP_WRITE_BIT |
+                                             GL_MAP_INVALIDATE_RANGE_BIT);
+   if (idx == NULL)
+      return VG_FALSE;
+
+   SHint k = 0;
+   for (SHint c = 0, start = 0; c < p->contours.size; ++c) {
+      SHint n = p->contours.items[c];
+      if (k > 0)
+         idx[k++] = 0xFFFFFFFF;
+      for (SHint i = 0; i < n; ++i)
+         idx[k++] = start + i;
+      start += n;
    }
 
-   shDrawQuads(p->min.x - K, p->min.y - K, p->max.x + K, p->min.y - K, p->max.x + K, p->max.y + K, p->min.x - K, p->max.y + K);
+   if (glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER) == GL_FALSE)
+      return VG_FALSE;
 
+   p->fillIndexCount = count;
+   p->fillIndicesValid = VG_TRUE;
+   return VG_TRUE;
 }
 
+static void
+shDrawVertices(SHPath * restrict p, GLenum mode)
+{
+   SH_ASSERT(p != NULL);
+   shBindPathBuffer(&p->fillBuffer, &p->fillBufferSize,
+                    &p->fillBufferCount, p->vertices.items,
+                    p->vertices.size, sizeof(SHVector2));
+   glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+   glEnableVertexAttribArray(position_loc);
+
+   /* Contours must be drawn as separate fans or strips to
+      properly handle the fill modes. Several contours are
+      joined with restart indices into a single draw call. */
+   if (p->contours.size <= 1) {
+      glDrawArrays(mode, 0, p->vertices.size);
+   } else if (shBindPathIndices(p)) {
+      glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+      glDrawElements(mode, p->fillIndexCount, GL_UNSIGNED_INT, NULL);
+      glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+   } else {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      SHint start = 0;
+      for (SHint c = 0; c < p->contours.size; ++c) {
+         glDrawArrays(mode, start, p->contours.items[c]);
+         start += p->contours.items[c];
+      }
+   }
+   glDisableVertexAttribArray(position_loc);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
 /*--------------------------------------------------------------
  * Constructs & draws colored OpenGL primitives that cover the
  * given bounding box to represent the currently selected
- * stroke or fill paint
+ * stroke or fill paint. Returns VG_TRUE if the primitives
+ * also cover the box padding that stroke geometry may reach,
+ * i.e. whether the cover pass zeroed all the stencil.
  *--------------------------------------------------------------*/
 
-static void shDrawPaintMesh(VGContext *c, SHVector2 *min, SHVector2 *max,
+static VGboolean shDrawPaintMesh(VGContext *c, SHVector2 *min, SHVector2 *max,
                 VGPaintMode mode, GLenum texUnit)
 {
    SH_ASSERT(c != NULL && min != NULL && max != NULL);
@@ -359,16 +463,16 @@ static void shDrawPaintMesh(VGContext *c, SHVector2 *min, SHVector2 *max,
    switch (p->type) {
    case VG_PAINT_TYPE_LINEAR_GRADIENT:
       shDrawLinearGradientMesh(p, min, max, mode, texUnit);
-      break;
+      return VG_FALSE;
 
    case VG_PAINT_TYPE_RADIAL_GRADIENT:
       shDrawRadialGradientMesh(p, min, max, mode, texUnit);
-      break;
+      return VG_FALSE;
 
    case VG_PAINT_TYPE_PATTERN:
-      if (p->pattern != VG_INVALID_HANDLE) {
+      if (shIsValidImage(c, p->pattern)) {
          shDrawPatternMesh(p, min, max, mode, texUnit);
-         break;
+         return VG_FALSE;
       }                         /* else behave as a color paint */
 
    case VG_PAINT_TYPE_COLOR:
@@ -376,40 +480,98 @@ static void shDrawPaintMesh(VGContext *c, SHVector2 *min, SHVector2 *max,
       shDrawQuads(pmin.x, pmin.y, pmax.x, pmin. y,pmax.x, pmax.y, pmin.x, pmax.y);
       break;
    }
+   return VG_TRUE;
+}
+
+/*--------------------------------------------------------------
+ * Decides whether a color cover pass should redraw the path's
+ * own fans or stroke triangles instead of its bounding box.
+ * They touch every pixel the stencil pass did, and the stencil
+ * test lets each of them be painted only once, so they are an
+ * exact cover. They are chosen when their area is well below
+ * that of the padded box, e.g. for thin diagonal shapes. The
+ * areas are measured once per tessellation.
+ *--------------------------------------------------------------*/
+
+#define SH_TIGHT_COVER_RATIO 0.5f
+
+static SHfloat
+shTriangleArea(const SHVector2 * a, const SHVector2 * b, const SHVector2 * c)
+{
+   return 0.5f * SH_ABS((b->x - a->x) * (c->y - a->y) -
+                        (c->x - a->x) * (b->y - a->y));
 }
 
 static VGboolean
-shIsTessCacheValid(VGContext * restrict c, SHPath * restrict p)
+shUseTightCover(VGContext * restrict c, SHPath * restrict p, VGPaintMode mode)
+{
+   SHfloat K = 1.0f;
+   SHfloat area;
+
+   /* Only the vertices appended since the last measure are
+      added, starting from the contour the first one is in */
+   if (mode == VG_FILL_PATH) {
+      if (p->fillArea < 0.0f) {
+         p->fillArea = 0.0f;
+         p->fillAreaCount = 0;
+      }
+      SHint k = p->contours.size, start = p->vertices.size;
+      while (k > 0 && start > p->fillAreaCount)
+         start -= p->contours.items[--k];
+      for (; k < p->contours.size; ++k) {
+         SHint n = p->contours.items[k];
+         const SHVector2 *v = &p->vertices.items[start];
+         for (SHint i = SH_MAX(2, p->fillAreaCount - start); i < n; ++i)
+            p->fillArea += shTriangleArea(&v[0], &v[i - 1], &v[i]);
+         start += n;
+      }
+      p->fillAreaCount = p->vertices.size;
+      area = p->fillArea;
+   } else {
+      if (p->strokeArea < 0.0f) {
+         p->strokeArea = 0.0f;
+         p->strokeAreaCount = 0;
+      }
+      for (SHint i = p->strokeAreaCount; i + 2 < p->stroke.size; i += 3)
+         p->strokeArea += shTriangleArea(&p->stroke.items[i],
+                                         &p->stroke.items[i + 1],
+                                         &p->stroke.items[i + 2]);
+      p->strokeAreaCount = p->stroke.size;
+      area = p->strokeArea;
+      K = SH_CEIL(c->strokeMiterLimit * c->strokeLineWidth) + 1.0f;
+   }
+
+   SHfloat box = (p->max.x - p->min.x + 2 * K) * (p->max.y - p->min.y + 2 * K);
+   return area < box * SH_TIGHT_COVER_RATIO;
+}
+
+static VGboolean
+shIsTessCacheValid(VGContext * restrict c, SHPath * restrict p,
+                   SHint bucket)
 {
    SH_ASSERT(c != NULL && p != NULL);
 
-   SHfloat nX, nY;
-   SHVector2 X, Y;
-   SHMatrix3x3 mi, mchange;
    VGboolean valid = VG_TRUE;
 
    if (p->cacheDataValid == VG_FALSE) {
+      /* Path data changed, every cached level is stale */
+      for (SHint i = 0; i < SH_PATH_LOD_COUNT; ++i)
+         p->lods[i].bucket = SH_PATH_LOD_NONE;
+      p->cacheBucket = SH_PATH_LOD_NONE;
       valid = VG_FALSE;
    } else if (p->cacheTransformInit == VG_FALSE) {
       valid = VG_FALSE;
-   } else if (shInvertMatrix(&p->cacheTransform, &mi) == VG_FALSE) {
+   } else if (p->cacheBucket != bucket && p->cacheBucket != bucket + 1) {
+      /* Too coarse when zoomed in, too many vertices when
+         zoomed out. One level finer is still adequate.
+         Rotation and translation don't matter in user space. */
       valid = VG_FALSE;
-   } else {
-      /* TODO: Compare change matrix for any scale or shear  */
-      MULMATMAT(c->pathTransform, mi, mchange);
-      SET2(X, mi.m[0][0], mi.m[1][0]);
-      SET2(Y, mi.m[0][1], mi.m[1][1]);
-      nX = NORM2(X);
-      nY = NORM2(Y);
-      if (nX > 1.01f || nX < 0.99 || nY > 1.01f || nY < 0.99)
-         valid = VG_FALSE;
    }
 
    if (valid == VG_FALSE) {
       /* Update cache */
       p->cacheDataValid = VG_TRUE;
       p->cacheTransformInit = VG_TRUE;
-      p->cacheTransform = c->pathTransform;
       p->cacheStrokeTessValid = VG_FALSE;
    }
 
@@ -449,177 +611,898 @@ shIsStrokeCacheValid(VGContext * restrict c, SHPath * restrict p)
 }
 
 /*-----------------------------------------------------------
- * Tessellates / strokes the path and draws it according to
- * VGContext state.
+ * Scissor setup shared by all path draws. Returns VG_FALSE
+ * if the scissor rectangle leaves nothing to draw.
  *-----------------------------------------------------------*/
-// TODO: leggi https://stackoverflow.com/questions/31336454/draw-quadratic-curve-on-gpu
-// http://www.glprogramming.com/red/chapter12.html
 
-VG_API_CALL void vgDrawPath(VGPath path, VGbitfield paintModes)
+static VGboolean
+shBeginScissor(VGContext * restrict c)
 {
-   VG_GETCONTEXT(VG_NO_RETVAL);
+   if (c->scissoring == VG_TRUE) {
+      SHRectangle *rect = &c->scissor.items[0];
+      if (c->scissor.size == 0)
+         return VG_FALSE;
+      if (rect->w <= 0.0f || rect->h <= 0.0f)
+         return VG_FALSE;
+      glScissor((GLint) rect->x, (GLint) rect->y, (GLint) rect->w,
+                (GLint) rect->h);
+      glEnable(GL_SCISSOR_TEST);
+   }
+   return VG_TRUE;
+}
 
-   VG_RETURN_ERR_IF(!shIsValidPath(context, path),
-                    VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
+static inline void
+shEndScissor(VGContext * restrict c)
+{
+   if (c->scissoring == VG_TRUE)
+      glDisable(GL_SCISSOR_TEST);
+}
 
-   VG_RETURN_ERR_IF(paintModes & (~(VG_STROKE_PATH | VG_FILL_PATH)),
-                    VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
+/*-----------------------------------------------------------
+ * Stencil lifecycle: every pass that writes the stencil
+ * zeroes it again in its cover pass, so the stencil only
+ * needs clearing once per frame (the ancillary buffers are
+ * undefined after a swap) unless vgClear did it already.
+ * The frame ends in shEndFrame, i.e. on vgFlush, vgFinish
+ * or vgEndFrameSH, so one of them has to come before each
+ * buffer swap; a full surface vgClear also starts a frame.
+ *-----------------------------------------------------------*/
 
-   /* Check whether scissoring is enabled and scissor
-      rectangle is valid */
+static void
+shClearStencilOnce(VGContext * restrict c)
+{
+   if (c->stencilClear)
+      return;
 
-   if (context->scissoring == VG_TRUE) {
-      SHRectangle *rect = &context->scissor.items[0];
-      if (context->scissor.size == 0)
-         VG_RETURN(VG_NO_RETVAL);
-      if (rect->w <= 0.0f || rect->h <= 0.0f)
-         VG_RETURN(VG_NO_RETVAL);
-      glScissor((GLint) rect->x, (GLint) rect->y, (GLint) rect->w,
-                (GLint) rect->h);
-   glEnable(GL_SCISSOR_TEST);
+   glDisable(GL_SCISSOR_TEST);
+   glStencilMask(0xff);
+   glClear(GL_STENCIL_BUFFER_BIT);
+   if (c->scissoring == VG_TRUE)
+      glEnable(GL_SCISSOR_TEST);
+
+   c->stencilClear = VG_TRUE;
+}
+
+/*-----------------------------------------------------------
+ * Makes the path's current tessellation match the scale of
+ * the current path transform. Paths are flattened in user
+ * space for power of two buckets of the transform's largest
+ * scale factor, with the surface tolerance divided by the
+ * bucket's upper scale, so chords stay within tolerance on
+ * the surface. A few recently used buckets are kept per path
+ * so zooming back and forth only flattens each one once; the
+ * least recently used one is evicted.
+ *-----------------------------------------------------------*/
+
+#define SH_TESS_MIN_BUCKET  -16
+#define SH_TESS_MAX_BUCKET   16
+
+static SHint
+shScaleBucket(SHfloat scale)
+{
+   int e = 0;
+
+   /* A degenerate matrix uses the tolerance in user units */
+   if (!(scale > 0.0f))
+      return 0;
+
+   /* scale <= 2^e */
+   frexpf(scale, &e);
+   SH_CLAMP(e, SH_TESS_MIN_BUCKET, SH_TESS_MAX_BUCKET);
+   return e;
+}
+
+static SHPathLOD *
+shFindPathLOD(SHPath * restrict p, SHint bucket)
+{
+   SHPathLOD *finer = NULL, *victim = &p->lods[0];
+
+   for (SHint i = 0; i < SH_PATH_LOD_COUNT; ++i) {
+      SHPathLOD *l = &p->lods[i];
+      if (l->bucket == bucket)
+         return l;
+      if (l->bucket == bucket + 1)
+         finer = l;
+      if (victim->bucket != SH_PATH_LOD_NONE &&
+          (l->bucket == SH_PATH_LOD_NONE || l->lastUse < victim->lastUse))
+         victim = l;
    }
 
-   SHPath *p = (SHPath *) path;
+   return finer ? finer : victim;
+}
+
+/* The path transform maps to normalized device coordinates,
+   two units across the surface, so the simplification
+   tolerance is converted from pixels along its longer side */
+static SHfloat
+shSimplifyTolerance(VGContext * restrict c, SHint bucket)
+{
+   SHint pixels = SH_MAX(c->surfaceWidth, c->surfaceHeight);
+
+   if (pixels <= 0)
+      return ldexpf(SH_PATH_FLATTEN_TOLERANCE, -bucket);
+   return ldexpf(SH_PATH_SIMPLIFY_TOLERANCE * 2.0f / pixels, -bucket);
+}
 
-   /* If user-to-surface matrix invertible tessellate in
-      surface space for better path resolution */
+static void
+shUpdateTessellation(VGContext * restrict c, SHPath * restrict p)
+{
+   SHint bucket = shScaleBucket(shMatrixMaxScale(&c->pathTransform));
 
-   if (shIsTessCacheValid(context, p) == VG_FALSE) {
-      SHMatrix3x3 mi;
-      if (shInvertMatrix(&context->pathTransform, &mi)) {
-         // TODO: replace shFlattenPath with libtess2
-         shFlattenPath(p, 1);
-         shTransformVertices(&mi, p);
+   /* Vertices simplified for another quality are stale */
+   if (p->cacheRenderingQuality != c->renderingQuality) {
+      p->cacheRenderingQuality = c->renderingQuality;
+      p->cacheDataValid = VG_FALSE;
+   }
+
+   /* Vertices of no bucket, left by a query, go to a free
+      level so that a cached one can be taken */
+   VGboolean stash = p->cacheTransformInit && p->cacheDataValid;
+
+   if (!shIsTessCacheValid(c, p, bucket)) {
+      /* Keep the current level and take a cached one */
+      if (stash) {
+         SHPathLOD *l = shFindPathLOD(p, bucket);
+         shSwapPathLOD(p, l);
+         l->lastUse = ++p->lodClock;
+      }
+
+      if (!stash || (p->cacheBucket != bucket &&
+                     p->cacheBucket != bucket + 1)) {
+         shFlattenPath(p, ldexpf(SH_PATH_FLATTEN_TOLERANCE, -bucket));
+         if (c->renderingQuality != VG_RENDERING_QUALITY_BETTER)
+            shSimplifyPath(c, p, shSimplifyTolerance(c, bucket));
+         p->cacheBucket = bucket;
+      }
+   }
+
+   /* Only flatten the segments appended since. Simplified
+      vertices are redone as a whole instead, so that they
+      do not depend on how the path data was appended */
+   if (p->flattenEnd.seg < p->segCount) {
+      if (c->renderingQuality != VG_RENDERING_QUALITY_BETTER) {
+         shFlattenPath(p, p->flattenTolerance);
+         shSimplifyPath(c, p, shSimplifyTolerance(c, p->cacheBucket));
       } else {
-         shFlattenPath(p, 0);
+         shFlattenPathTail(p);
       }
-      shFindBoundbox(p);    // p->min and p->max set here
    }
+}
 
-   /* Change render quality according to the context */
-   /* TODO: Turn antialiasing on/off */
-   shSetRenderQualityGL(context->renderingQuality);
+/*-----------------------------------------------------------
+ * Returns VG_TRUE if the path has a triangle mesh for the
+ * current fill rule. Paths are only triangulated after
+ * they have been filled a few times unchanged, so paths
+ * rebuilt every frame keep using the stencil.
+ *-----------------------------------------------------------*/
 
-   /* Pick paint if available or default */
-   SHPaint *fill = (context->fillPaint ? context->fillPaint : &context->defaultPaint);
-   SHPaint *stroke =
-      (context->strokePaint ? context->strokePaint : &context->defaultPaint);
+static VGboolean
+shUpdateMesh(VGContext * restrict c, SHPath * restrict p)
+{
+   if (p->meshValid && p->meshFillRule == c->fillRule)
+      return VG_TRUE;
 
+   if (p->meshUses < 0 || ++p->meshUses < SH_TRIANGULATE_MIN_USES)
+      return VG_FALSE;
 
-   /* Apply path to surface transformation */
-   SHfloat mgl[16];
-   shMatrixToGL(&context->pathTransform, mgl);
+   if (p->vertices.size > SH_TRIANGULATE_MAX_VERTICES ||
+       !shTriangulatePath(c, p, c->fillRule)) {
+      p->meshUses = -1;
+      return VG_FALSE;
+   }
+
+   p->meshFillRule = c->fillRule;
+   p->meshValid = VG_TRUE;
+   p->meshBufferCount = 0;
+   return VG_TRUE;
+}
 
-// Matrix multiplication done in vertex shader
+/*-----------------------------------------------------------
+ * Apply path to surface transformation. Matrix
+ * multiplication is done in the vertex shader.
+ *-----------------------------------------------------------*/
 
+static inline void
+shLoadPathTransformGL(SHMatrix3x3 * m)
+{
+   SHfloat mgl[16];
+   shMatrixToGL(m, mgl);
    glUniformMatrix4fv(locm, 1, GL_FALSE , (GLfloat *) mgl );
+}
 
-   // TODO: bisogna capire se serve sempre abilitare la scrittura nello stencil (sembra crei problemi a test_composition)
-   if (paintModes & VG_FILL_PATH) {
-      /* Tesselate into stencil */
+/*--------------------------------------------------------------
+ * Covers a batch of paths with what is currently bound: each
+ * path's fans or stroke triangles where tight covers are
+ * allowed and shUseTightCover picks them, its padded bounding
+ * box otherwise. The boxes of a chunk are streamed first and
+ * uploaded with a single flush before any is drawn.
+ *--------------------------------------------------------------*/
 
-      glEnable(GL_STENCIL_TEST);
-      glStencilMask(0xff) ;
-      glClear(GL_STENCIL_BUFFER_BIT);
-      glStencilFunc(GL_ALWAYS, 0, 0);
+#define SH_COVER_CHUNK 256
+
+static void
+shCoverPaths(VGContext * restrict c, SHDrawCommand ** cmds, SHint count,
+             VGPaintMode mode, VGboolean tight)
+{
+   SH_ASSERT(c != NULL && cmds != NULL);
+
+   SHfloat K = 1.0f;
+   if (mode == VG_STROKE_PATH)
+      K = SH_CEIL(c->strokeMiterLimit * c->strokeLineWidth) + 1.0f;
+
+   /* -1 marks a tight cover */
+   GLintptr offsets[SH_COVER_CHUNK];
+
+   for (SHint first = 0; first < count; first += SH_COVER_CHUNK) {
+      SHint n = SH_MIN(SH_COVER_CHUNK, count - first);
+
+      for (SHint i = 0; i < n; ++i) {
+         SHDrawCommand *cmd = cmds[first + i];
+         if (tight && shUseTightCover(c, cmd->p, mode)) {
+            offsets[i] = -1;
+         } else {
+            GLfloat corners[8] = {
+               cmd->min.x - K, cmd->min.y - K, cmd->max.x + K, cmd->min.y - K,
+               cmd->max.x + K, cmd->max.y + K, cmd->min.x - K, cmd->max.y + K
+            };
+            offsets[i] = shStreamData(&c->stream, corners, sizeof(corners));
+         }
+      }
+      shStreamFlush(&c->stream);
+
+      for (SHint i = 0; i < n; ++i) {
+         SHDrawCommand *cmd = cmds[first + i];
+         c->pathTransform = cmd->pathTransform;
+         if (count > 1)
+            shLoadPathTransformGL(&c->pathTransform);
+
+         if (offsets[i] < 0) {
+            if (mode == VG_FILL_PATH)
+               shDrawVertices(cmd->p, GL_TRIANGLE_FAN);
+            else
+               shDrawStroke(cmd->p);
+            continue;
+         }
+
+         glBindBuffer(GL_ARRAY_BUFFER, c->stream.buffer);
+         glVertexAttribPointer(position_loc, 2, GL_FLOAT, GL_FALSE, 0,
+                               (GLvoid *) offsets[i]);
+         glEnableVertexAttribArray(position_loc);
+         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+         glDisableVertexAttribArray(position_loc);
+         glBindBuffer(GL_ARRAY_BUFFER, 0);
+      }
+   }
+}
+
+/*-----------------------------------------------------------
+ * Draw state snapshot of a vgDrawPath call. Draws are
+ * executed from these so that deferred and immediate
+ * drawing share the same code.
+ *-----------------------------------------------------------*/
+
+static void
+shCaptureDrawState(VGContext * restrict c, SHDrawCommand * restrict cmd)
+{
+   SHPaint *fill = (c->fillPaint ? c->fillPaint : &c->defaultPaint);
+   SHPaint *stroke = (c->strokePaint ? c->strokePaint : &c->defaultPaint);
+
+   cmd->fillPaint = c->fillPaint;
+   cmd->strokePaint = c->strokePaint;
+   cmd->fillColor = fill->color;
+   cmd->fillType = fill->type;
+   cmd->strokeColor = stroke->color;
+   cmd->strokeType = stroke->type;
+   cmd->pathTransform = c->pathTransform;
+   cmd->fillRule = c->fillRule;
+   cmd->blendMode = c->blendMode;
+   cmd->renderingQuality = c->renderingQuality;
+   cmd->scissoring = c->scissoring;
+   if (c->scissor.size > 0)
+      cmd->scissor = c->scissor.items[0];
+   else
+      cmd->scissor.x = cmd->scissor.y = cmd->scissor.w = cmd->scissor.h = 0.0f;
+   cmd->strokeLineWidth = c->strokeLineWidth;
+   cmd->strokeCapStyle = c->strokeCapStyle;
+   cmd->strokeJoinStyle = c->strokeJoinStyle;
+   cmd->strokeMiterLimit = c->strokeMiterLimit;
+   cmd->strokeDashPhase = c->strokeDashPhase;
+   cmd->strokeDashPhaseReset = c->strokeDashPhaseReset;
+   cmd->strokeDashPattern = c->strokeDashPattern.items;
+   cmd->strokeDashCount = c->strokeDashPattern.size;
+}
+
+/* Loads a snapshot back into the context. The scissor and dash
+   arrays become views on the command's own data. */
+static void
+shApplyDrawState(VGContext * restrict c, SHDrawCommand * restrict cmd)
+{
+   c->fillPaint = cmd->fillPaint;
+   c->strokePaint = cmd->strokePaint;
+   c->pathTransform = cmd->pathTransform;
+   c->fillRule = cmd->fillRule;
+   c->blendMode = cmd->blendMode;
+   c->renderingQuality = cmd->renderingQuality;
+   c->scissoring = cmd->scissoring;
+   c->scissor.items = &cmd->scissor;
+   c->scissor.size = c->scissor.capacity = 1;
+   c->strokeLineWidth = cmd->strokeLineWidth;
+   c->strokeCapStyle = cmd->strokeCapStyle;
+   c->strokeJoinStyle = cmd->strokeJoinStyle;
+   c->strokeMiterLimit = cmd->strokeMiterLimit;
+   c->strokeDashPhase = cmd->strokeDashPhase;
+   c->strokeDashPhaseReset = cmd->strokeDashPhaseReset;
+   c->strokeDashPattern.items = cmd->strokeDashPattern;
+   c->strokeDashPattern.size = c->strokeDashPattern.capacity = cmd->strokeDashCount;
+}
+
+/*-----------------------------------------------------------
+ * Fills a list of paths that share paint, blending and
+ * scissor state and do not overlap: all paths go into the
+ * stencil first, then paint and stencil clear are drawn
+ * once per path, or once over their union when a color
+ * paint is applied with a common transform.
+ *-----------------------------------------------------------*/
+
+static VGboolean
+shSameTransform(SHDrawCommand ** cmds, SHint count)
+{
+   for (SHint i = 1; i < count; ++i)
+      if (memcmp(&cmds[i]->pathTransform, &cmds[0]->pathTransform,
+                 sizeof(SHMatrix3x3)))
+         return VG_FALSE;
+   return VG_TRUE;
+}
+
+static void
+shFillPaths(VGContext * restrict c, SHDrawCommand ** cmds, SHint count)
+{
+   SHPaint *fill = (c->fillPaint ? c->fillPaint : &c->defaultPaint);
+
+   /* A convex contour covers each pixel inside it exactly once
+      as a fan, and so does a triangulated path, so with a color
+      paint they can be blended straight into the color buffer.
+      Only the other paths (kept in cmds, whose paths never
+      overlap) go through stencil-then-cover. */
+   if (fill->type == VG_PAINT_TYPE_COLOR) {
+      VGboolean blending = VG_FALSE;
+      SHint rest = 0;
+
+      for (SHint i = 0; i < count; ++i) {
+         SHPath *p = cmds[i]->p;
+         c->pathTransform = cmds[i]->pathTransform;
+         shUpdateTessellation(c, p);
+         VGboolean mesh = !p->convex && shUpdateMesh(c, p);
+         if (!p->convex && !mesh) {
+            cmds[rest++] = cmds[i];
+            continue;
+         }
+         if (!blending) {
+            updateBlendingStateGL(c, fill->color.a == 1.0f);
+            glUniform4fv(color4_loc, 1, (GLfloat *)&fill->color) ;
+            blending = VG_TRUE;
+         }
+         shLoadPathTransformGL(&c->pathTransform);
+         if (mesh)
+            shDrawMesh(p);
+         else
+            shDrawVertices(p, GL_TRIANGLE_FAN);
+      }
+
+      if (blending)
+         glDisable(GL_BLEND);
+      count = rest;
+      if (count == 0)
+         return;
+   }
+
+   VGboolean merge = count > 1 && fill->type == VG_PAINT_TYPE_COLOR &&
+                     shSameTransform(cmds, count);
+   SHVector2 min, max;
+
+   /* Tesselate into stencil: the fans flip it for the even-odd
+      rule and count windings, up for counter-clockwise
+      triangles and down for clockwise ones, for non-zero */
+   glEnable(GL_STENCIL_TEST);
+   glStencilMask(0xff) ;
+   glStencilFunc(GL_ALWAYS, 0, 0);
+   if (c->fillRule == VG_NON_ZERO) {
+      glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+      glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+   } else {
       glStencilOp(GL_INVERT, GL_INVERT, GL_INVERT);
-      glDepthMask(GL_FALSE) ;
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+   }
+   glDepthMask(GL_FALSE) ;
+   glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+   for (SHint i = 0; i < count; ++i) {
+      SHPath *p = cmds[i]->p;
+      c->pathTransform = cmds[i]->pathTransform;
+      shUpdateTessellation(c, p);
+      shLoadPathTransformGL(&c->pathTransform);
       shDrawVertices(p, GL_TRIANGLE_FAN);
+      cmds[i]->min = p->min;
+      cmds[i]->max = p->max;
+      if (i == 0) {
+         min = p->min;
+         max = p->max;
+      } else {
+         min.x = SH_MIN(min.x, p->min.x);
+         min.y = SH_MIN(min.y, p->min.y);
+         max.x = SH_MAX(max.x, p->max.x);
+         max.y = SH_MAX(max.y, p->max.y);
+      }
+   }
 
-      /* Setup blending */
-      updateBlendingStateGL(context,
-                            fill->type == VG_PAINT_TYPE_COLOR &&
-                            fill->color.a == 1.0f);
-
-      /* Draw paint where stencil odd */
+   /* Setup blending */
+   updateBlendingStateGL(c,
+                         fill->type == VG_PAINT_TYPE_COLOR &&
+                         fill->color.a == 1.0f);
+
+   /* Draw paint where stencil odd, or non zero for the
+      non-zero rule. The fan triangles lie within the path
+      bounds which every paint mesh covers, so zeroing on
+      both pass and fail leaves the stencil clear for the
+      next path. */
+   if (c->fillRule == VG_NON_ZERO)
+      glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+   else
       glStencilFunc(GL_EQUAL, 1, 1);
-      glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-      shDrawPaintMesh(context, &p->min, &p->max, VG_FILL_PATH, GL_TEXTURE0);
-      /* Clear stencil for sure */
-      /* TODO: Is there any way to do this safely along
-         with the paint generation pass?? */
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-      shDrawBoundBox(context, p, VG_FILL_PATH);
-      /* Reset state */
+   glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+   glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+   if (merge) {
+      shDrawPaintMesh(c, &min, &max, VG_FILL_PATH, GL_TEXTURE0);
+   } else if (fill->type == VG_PAINT_TYPE_COLOR) {
+      glUniform4fv(color4_loc, 1, (GLfloat *)&fill->color) ;
+      shCoverPaths(c, cmds, count, VG_FILL_PATH, VG_TRUE);
+   } else {
+      for (SHint i = 0; i < count; ++i) {
+         c->pathTransform = cmds[i]->pathTransform;
+         if (count > 1)
+            shLoadPathTransformGL(&c->pathTransform);
+         shDrawPaintMesh(c, &cmds[i]->min, &cmds[i]->max, VG_FILL_PATH,
+                         GL_TEXTURE0);
+      }
+   }
+
+   /* Reset state */
+   glDisable(GL_BLEND);
+   glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+   glDisable(GL_STENCIL_TEST);
+}
+
+/*-----------------------------------------------------------
+ * Strokes a list of paths, batched like shFillPaths. All
+ * of them share the stroke parameters of the context.
+ *-----------------------------------------------------------*/
+
+static void
+shStrokePaths(VGContext * restrict c, SHDrawCommand ** cmds, SHint count)
+{
+   SHPaint *stroke =
+      (c->strokePaint ? c->strokePaint : &c->defaultPaint);
+
+// Now using <= 0.1 line with to select minimum line width
+   if (c->strokeLineWidth <= 0.1f) {
+
+      /* Simulate thin stroke by alpha */
+      SHColor col = stroke->color;
+      if (c->strokeLineWidth < 0.1f && c->strokeLineWidth != 0.0f)
+         col.a *= c->strokeLineWidth * 10;
+
+      /* Draw contour as a line */
+      glBlendEquation(GL_FUNC_ADD);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      glEnable(GL_BLEND);
+      glUniform4fv(color4_loc, 1, (GLfloat *)&col) ;
+      for (SHint i = 0; i < count; ++i) {
+         c->pathTransform = cmds[i]->pathTransform;
+         shUpdateTessellation(c, cmds[i]->p);
+         shLoadPathTransformGL(&c->pathTransform);
+         shDrawVertices(cmds[i]->p, GL_LINE_STRIP);
+      }
       glDisable(GL_BLEND);
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-      glDisable(GL_STENCIL_TEST);
+      return;
+   }
 
+   VGboolean merge = count > 1 && stroke->type == VG_PAINT_TYPE_COLOR &&
+                     shSameTransform(cmds, count);
+   SHVector2 min, max;
+
+   /* Stroke into stencil */
+   glEnable(GL_STENCIL_TEST);
+   glStencilMask(0xff) ;
+   glStencilFunc(GL_NOTEQUAL, 1, 1);
+   glStencilOp(GL_KEEP, GL_INCR, GL_INCR);
+   glDepthMask(GL_FALSE) ;
+   glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+   for (SHint i = 0; i < count; ++i) {
+      SHPath *p = cmds[i]->p;
+      c->pathTransform = cmds[i]->pathTransform;
+      shUpdateTessellation(c, p);
+      if (shIsStrokeCacheValid(c, p) == VG_FALSE) {
+         /* Generate stroke triangles in user space */
+         shVector2ArrayClear(&p->stroke);
+         shStrokePath(c, p);
+      } else if (p->strokeEnd.vertices != p->vertices.size) {
+         /* Restroke from the last contour's open end, taking
+            the triangles dropped back out of the area */
+         if (p->strokeArea >= 0.0f &&
+             p->strokeAreaCount > p->strokeEnd.strokeSize) {
+            for (SHint k = p->strokeEnd.strokeSize;
+                 k + 2 < p->strokeAreaCount; k += 3)
+               p->strokeArea -= shTriangleArea(&p->stroke.items[k],
+                                               &p->stroke.items[k + 1],
+                                               &p->stroke.items[k + 2]);
+            p->strokeAreaCount = p->strokeEnd.strokeSize;
+         }
+         shStrokePathTail(c, p);
+      }
+      shLoadPathTransformGL(&c->pathTransform);
+      shDrawStroke(p);
+      cmds[i]->min = p->min;
+      cmds[i]->max = p->max;
+      if (i == 0) {
+         min = p->min;
+         max = p->max;
+      } else {
+         min.x = SH_MIN(min.x, p->min.x);
+         min.y = SH_MIN(min.y, p->min.y);
+         max.x = SH_MAX(max.x, p->max.x);
+         max.y = SH_MAX(max.y, p->max.y);
+      }
+   }
+
+   /* Setup blending */
+   updateBlendingStateGL(c,
+                         stroke->type == VG_PAINT_TYPE_COLOR &&
+                         stroke->color.a == 1.0f);
+
+   /* Draw paint where stencil odd */
+   glStencilFunc(GL_EQUAL, 1, 1);
+   glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+   glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+   VGboolean cleared = VG_TRUE;
+   if (merge) {
+      shDrawPaintMesh(c, &min, &max, VG_STROKE_PATH, GL_TEXTURE0);
+   } else if (stroke->type == VG_PAINT_TYPE_COLOR) {
+      glUniform4fv(color4_loc, 1, (GLfloat *)&stroke->color) ;
+      shCoverPaths(c, cmds, count, VG_STROKE_PATH, VG_TRUE);
+   } else {
+      for (SHint i = 0; i < count; ++i) {
+         c->pathTransform = cmds[i]->pathTransform;
+         if (count > 1)
+            shLoadPathTransformGL(&c->pathTransform);
+         if (!shDrawPaintMesh(c, &cmds[i]->min, &cmds[i]->max,
+                              VG_STROKE_PATH, GL_TEXTURE0))
+            cleared = VG_FALSE;
+      }
+   }
+
+   /* Gradient and pattern meshes only span the path bounds
+      while the stroke reaches past them: clear the rest */
+   glDisable(GL_BLEND);
+   if (!cleared) {
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+      shCoverPaths(c, cmds, count, VG_STROKE_PATH, VG_FALSE);
    }
 
+   /* Reset state */
+   glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+   glDisable(GL_STENCIL_TEST);
+}
+
+/*-----------------------------------------------------------
+ * Draws a batch of commands sharing one paint mode and the
+ * state compared by shCanBatch. Paint color and type can be
+ * set without flushing recorded draws, so the paint is given
+ * the ones recorded for the batch while it is drawn.
+ *-----------------------------------------------------------*/
+
+static void
+shExecuteCommands(VGContext * restrict c, SHDrawCommand ** cmds, SHint count)
+{
+   SHDrawCommand *cmd = cmds[0];
+   SHPaint *paint;
+
+   shClearStencilOnce(c);
+
+   if (shBeginScissor(c) == VG_FALSE)
+      return;
+
+   /* Change render quality according to the context */
    /* TODO: Turn antialiasing on/off */
-   shSetRenderQualityGL(context->renderingQuality);
-// Now using <= 0.1 line with to select minimum line width
-   if ((paintModes & VG_STROKE_PATH) && context->strokeLineWidth >= 0.0f) {
+   shSetRenderQualityGL(c->renderingQuality);
 
-       if (context->strokeLineWidth > 0.1f) {
-         if (shIsStrokeCacheValid(context, p) == VG_FALSE) {
-            /* Generate stroke triangles in user space */
-            shVector2ArrayClear(&p->stroke);
-            shStrokePath(context, p);
-         }
+   if (cmd->mode == VG_FILL_PATH)
+      paint = (c->fillPaint ? c->fillPaint : &c->defaultPaint);
+   else
+      paint = (c->strokePaint ? c->strokePaint : &c->defaultPaint);
 
-         /* Stroke into stencil */
-         glEnable(GL_STENCIL_TEST);
-         glStencilMask(0xff) ;
-         glClear(GL_STENCIL_BUFFER_BIT);
-         glStencilFunc(GL_NOTEQUAL, 1, 1);
-         glStencilOp(GL_KEEP, GL_INCR, GL_INCR);
-         glDepthMask(GL_FALSE) ;
-         glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-
-         shDrawStroke(p);
-
-         /* Setup blending */
-         updateBlendingStateGL(context,
-                               stroke->type == VG_PAINT_TYPE_COLOR &&
-                               stroke->color.a == 1.0f);
-
-         /* Draw paint where stencil odd */
-         glStencilFunc(GL_EQUAL, 1, 1);
-         glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
-         glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-         shDrawPaintMesh(context, &p->min, &p->max, VG_STROKE_PATH,
-                         GL_TEXTURE0);
+   SHColor color = paint->color;
+   VGPaintType type = paint->type;
 
-         /* Clear stencil for sure */
-         glDisable(GL_BLEND);
-         glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-         shDrawBoundBox(context, p, VG_STROKE_PATH);
+   if (cmd->mode == VG_FILL_PATH) {
+      paint->color = cmd->fillColor;
+      paint->type = cmd->fillType;
+      shFillPaths(c, cmds, count);
+   } else {
+      paint->color = cmd->strokeColor;
+      paint->type = cmd->strokeType;
+      shStrokePaths(c, cmds, count);
+   }
+
+   paint->color = color;
+   paint->type = type;
+
+   shEndScissor(c);
+}
 
-         /* Reset state */
-         glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-         glDisable(GL_STENCIL_TEST);
-         /*
-          * glDisable(GL_BLEND);
-          */
+/*-----------------------------------------------------------
+ * Deferred drawing. vgDrawPath records commands with their
+ * bounds after the path transform; shFlushCommands then
+ * groups each command with later ones that use the same
+ * state, provided none of them overlaps a command it
+ * would jump over or another member of the group, so the
+ * painter's order of overlapping draws is preserved.
+ *-----------------------------------------------------------*/
+
+#define SH_DEFERRED_BATCH_WINDOW 64
 
+static void
+shComputeCommandBounds(SHDrawCommand * cmd, SHPath * p, SHfloat K)
+{
+   SHVector2 corners[4];
+   SET2(corners[0], p->min.x - K, p->min.y - K);
+   SET2(corners[1], p->max.x + K, p->min.y - K);
+   SET2(corners[2], p->max.x + K, p->max.y + K);
+   SET2(corners[3], p->min.x - K, p->max.y + K);
+
+   for (SHint i = 0; i < 4; ++i) {
+      TRANSFORM2(corners[i], cmd->pathTransform);
+      if (i == 0) {
+         cmd->boundsMin = corners[0];
+         cmd->boundsMax = corners[0];
+      } else {
+         cmd->boundsMin.x = SH_MIN(cmd->boundsMin.x, corners[i].x);
+         cmd->boundsMin.y = SH_MIN(cmd->boundsMin.y, corners[i].y);
+         cmd->boundsMax.x = SH_MAX(cmd->boundsMax.x, corners[i].x);
+         cmd->boundsMax.y = SH_MAX(cmd->boundsMax.y, corners[i].y);
       }
-      else {
-
-         /* Simulate thin stroke by alpha */
-         SHColor c = stroke->color;
-         if (context->strokeLineWidth < 0.1f && context->strokeLineWidth != 0.0f)
-            c.a *= context->strokeLineWidth * 10; 
-
-         /* Draw contour as a line */
-         glBlendEquation(GL_FUNC_ADD);
-         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-         glEnable(GL_BLEND);
-         glUniform4fv(color4_loc, 1, (GLfloat *)&c) ;
-         shDrawVertices(p, GL_LINE_STRIP);
-         glDisable(GL_BLEND);
+   }
+}
+
+static inline VGboolean
+shCommandsOverlap(SHDrawCommand * a, SHDrawCommand * b)
+{
+   return a->boundsMin.x <= b->boundsMax.x && b->boundsMin.x <= a->boundsMax.x &&
+          a->boundsMin.y <= b->boundsMax.y && b->boundsMin.y <= a->boundsMax.y;
+}
+
+/* A batch stencils all its paths before covering any, so a
+   path drawn twice in it must keep one tessellation: at
+   another scale bucket the cover would draw the geometry
+   of the last one stencilled */
+static inline VGboolean
+shCommandsConflict(SHDrawCommand * a, SHDrawCommand * b)
+{
+   return a->path == b->path &&
+          shScaleBucket(shMatrixMaxScale(&a->pathTransform)) !=
+          shScaleBucket(shMatrixMaxScale(&b->pathTransform));
+}
+
+static VGboolean
+shCanBatch(SHDrawCommand * a, SHDrawCommand * b)
+{
+   if (a->mode != b->mode || a->blendMode != b->blendMode ||
+       a->renderingQuality != b->renderingQuality ||
+       a->scissoring != b->scissoring)
+      return VG_FALSE;
+
+   if (a->scissoring &&
+       memcmp(&a->scissor, &b->scissor, sizeof(SHRectangle)))
+      return VG_FALSE;
+
+   if (a->mode == VG_FILL_PATH)
+      return a->fillPaint == b->fillPaint &&
+             a->fillRule == b->fillRule &&
+             a->fillType == b->fillType &&
+             !memcmp(&a->fillColor, &b->fillColor, sizeof(SHColor));
+
+   return a->strokePaint == b->strokePaint &&
+          a->strokeType == b->strokeType &&
+          !memcmp(&a->strokeColor, &b->strokeColor, sizeof(SHColor)) &&
+          a->strokeLineWidth == b->strokeLineWidth &&
+          a->strokeCapStyle == b->strokeCapStyle &&
+          a->strokeJoinStyle == b->strokeJoinStyle &&
+          a->strokeMiterLimit == b->strokeMiterLimit &&
+          a->strokeDashCount == 0 && b->strokeDashCount == 0;
+}
+
+static void
+shRecordCommand(VGContext * restrict c, SHDrawCommand * cmd)
+{
+   SHPath *p = cmd->p;
+   SHfloat K = 1.0f;
+
+   /* Bounds are needed now to plan the batches */
+   shUpdateTessellation(c, p);
+   if (cmd->mode == VG_STROKE_PATH)
+      K = SH_CEIL(c->strokeMiterLimit * c->strokeLineWidth) + 1.0f;
+   shComputeCommandBounds(cmd, p, K);
+
+   /* The dash pattern may change before the flush */
+   if (cmd->strokeDashCount > 0) {
+      SHfloat *dash = shArenaAlloc(&c->frameArena,
+                                   cmd->strokeDashCount * sizeof(SHfloat));
+      if (dash == NULL) {
+         shFlushCommands(c);
+         shExecuteCommands(c, &cmd, 1);
+         return;
       }
+      memcpy(dash, cmd->strokeDashPattern,
+             cmd->strokeDashCount * sizeof(SHfloat));
+      cmd->strokeDashPattern = dash;
+   }
+
+   if (shDrawCommandArrayPushBackP(&c->commands, cmd) != VG_NO_ERROR) {
+      shFlushCommands(c);
+      shExecuteCommands(c, &cmd, 1);
+   }
+}
+
+void
+shFlushCommands(VGContext * c)
+{
+   SH_ASSERT(c != NULL);
+
+   SHint n = c->commands.size;
+   if (n == 0)
+      return;
+
+   /* Save the state the commands are replayed into */
+   SHDrawCommand saved;
+   SHRectArray scissor = c->scissor;
+   SHFloatArray dash = c->strokeDashPattern;
+   shCaptureDrawState(c, &saved);
+
+   SHDrawCommand *cmds = c->commands.items;
+   SHDrawCommand **batch = shArenaAlloc(&c->frameArena, n * sizeof(SHDrawCommand *));
+   SHuint8 *done = shArenaAlloc(&c->frameArena, n);
+   if (done != NULL)
+      memset(done, 0, n);
+
+   for (SHint i = 0; i < n; ++i) {
+      SHDrawCommand *first = &cmds[i];
+      SHint count = 1;
+
+      if (batch == NULL || done == NULL) {
+         /* Out of scratch memory: replay in order */
+         shApplyDrawState(c, first);
+         first->p = shGetPath(c, first->path);
+         if (first->p != NULL)
+            shExecuteCommands(c, &first, 1);
+         continue;
+      }
+
+      if (done[i])
+         continue;
+      done[i] = 1;
+      batch[0] = first;
+
+      for (SHint j = i + 1; j < n && j < i + SH_DEFERRED_BATCH_WINDOW; ++j) {
+         if (done[j] || !shCanBatch(first, &cmds[j]))
+            continue;
+
+         VGboolean ok = VG_TRUE;
+         for (SHint k = 0; k < count && ok; ++k)
+            if (shCommandsOverlap(batch[k], &cmds[j]) ||
+                shCommandsConflict(batch[k], &cmds[j]))
+               ok = VG_FALSE;
+         for (SHint k = i + 1; k < j && ok; ++k)
+            if (!done[k] && shCommandsOverlap(&cmds[k], &cmds[j]))
+               ok = VG_FALSE;
+
+         if (ok) {
+            batch[count++] = &cmds[j];
+            done[j] = 1;
+         }
+      }
+
+      /* Paths destroyed since recording are dropped */
+      SHint live = 0;
+      for (SHint k = 0; k < count; ++k) {
+         batch[k]->p = shGetPath(c, batch[k]->path);
+         if (batch[k]->p != NULL)
+            batch[live++] = batch[k];
+      }
+
+      if (live > 0) {
+         shApplyDrawState(c, batch[0]);
+         shExecuteCommands(c, batch, live);
+      }
+   }
+
+   c->commands.size = 0;
+
+   /* Restore the application state */
+   shApplyDrawState(c, &saved);
+   c->scissor = scissor;
+   c->strokeDashPattern = dash;
+}
+
+VG_API_CALL void
+vgDeferDrawingSH(VGboolean enable)
+{
+   VG_GETCONTEXT(VG_NO_RETVAL);
+
+   if (!enable)
+      shFlushCommands(context);
+   context->deferred = enable ? VG_TRUE : VG_FALSE;
+
+   VG_RETURN(VG_NO_RETVAL);
+}
+
+/*-----------------------------------------------------------
+ * Tessellates / strokes the path and draws it according to
+ * VGContext state.
+ *-----------------------------------------------------------*/
+// TODO: leggi https://stackoverflow.com/questions/31336454/draw-quadratic-curve-on-gpu
+// http://www.glprogramming.com/red/chapter12.html
+
+VG_API_CALL void vgDrawPath(VGPath path, VGbitfield paintModes)
+{
+   VG_GETCONTEXT(VG_NO_RETVAL);
+
+   VG_RETURN_ERR_IF(!shIsValidPath(context, path),
+                    VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
+
+   VG_RETURN_ERR_IF(paintModes & (~(VG_STROKE_PATH | VG_FILL_PATH)),
+                    VG_ILLEGAL_ARGUMENT_ERROR, VG_NO_RETVAL);
+
+   /* Check whether scissoring is enabled and scissor
+      rectangle is valid */
+
+   if (context->scissoring == VG_TRUE) {
+      SHRectangle *rect = &context->scissor.items[0];
+      if (context->scissor.size == 0)
+         VG_RETURN(VG_NO_RETVAL);
+      if (rect->w <= 0.0f || rect->h <= 0.0f)
+         VG_RETURN(VG_NO_RETVAL);
+   }
+
+   /* Only recorded draws outlive an API call, so without
+      them pending the scratch memory can go even if the
+      application never ends its frames */
+   if (context->commands.size == 0)
+      shArenaReset(&context->frameArena);
+
+   SHDrawCommand cmd;
+   SHDrawCommand *pcmd = &cmd;
+   shCaptureDrawState(context, &cmd);
+   cmd.path = path;
+   cmd.p = shGetPath(context, path);
+
+   if (paintModes & VG_FILL_PATH) {
+      cmd.mode = VG_FILL_PATH;
+      if (context->deferred)
+         shRecordCommand(context, &cmd);
+      else
+         shExecuteCommands(context, &pcmd, 1);
+   }
+
+   if ((paintModes & VG_STROKE_PATH) && context->strokeLineWidth >= 0.0f) {
+      cmd.mode = VG_STROKE_PATH;
+      if (context->deferred)
+         shRecordCommand(context, &cmd);
+      else
+         shExecuteCommands(context, &pcmd, 1);
    }
 
 // Return matrix to identity  (not)
 //   glUniformMatrix4fv(locm, 1, GL_FALSE , (GLfloat *) migu );
 
-   if (context->scissoring == VG_TRUE)
-      glDisable(GL_SCISSOR_TEST);
-
    VG_RETURN(VG_NO_RETVAL);
 }
 
@@ -630,6 +1513,7 @@ VG_API_CALL void vgDrawImage(VGImage image)
    SHVector2 min, max;
 
    VG_GETCONTEXT(VG_NO_RETVAL);
+   shFlushCommands(context);
 
    VG_RETURN_ERR_IF(!shIsValidImage(context, image),
                     VG_BAD_HANDLE_ERROR, VG_NO_RETVAL);
@@ -648,7 +1532,7 @@ VG_API_CALL void vgDrawImage(VGImage image)
    }
 
   /* Apply path to surface transformation */
-   SHImage *i = (SHImage *) image;
+   SHImage *i = shGetImage(context, image);
    shMatrixToGL(&context->pathTransform, mgl);
    glUniformMatrix4fv(locm, 1, GL_FALSE , (GLfloat *) mgl );
 
@@ -681,12 +1565,13 @@ VG_API_CALL void vgDrawImage(VGImage image)
    quadt.p3.x = 1.0; quadt.p3.y = 1.0;
    quadt.p4.x = 0.0; quadt.p4.y = 1.0;
 
-	GLvoid* textures  = (GLvoid*) &quadt;
+	GLvoid* textures  = (GLvoid*) shStreamVertices(&quadt, sizeof(quadt));
 // texture already set up by image load calling vgCreateImage
 
 // enabling vertex textures
 	glVertexAttribPointer(texc_loc, 2, GL_FLOAT, GL_FALSE, 0, textures);
 	glEnableVertexAttribArray(texc_loc);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
    /* Pick fill paint */
    SHPaint *fill = (context->fillPaint ? context->fillPaint : &context->defaultPaint);
@@ -744,7 +1629,7 @@ VG_API_CALL void vgDrawImage(VGImage image)
       glDisable(GL_BLEND);
       glDisable(GL_TEXTURE_2D);
       glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-      glClear(GL_STENCIL_BUFFER_BIT);
+      shClearStencilOnce(context);
       glDisable(GL_DEPTH_TEST);
       glEnable(GL_STENCIL_TEST);
 
@@ -755,7 +1640,7 @@ VG_API_CALL void vgDrawImage(VGImage image)
 
       glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
       glStencilFunc(GL_EQUAL, 1, ~0U);
-      glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+      glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
 
       /* Setup blending */
       updateBlendingStateGL(context, i->fd.premultiplied);
@@ -162,6 +162,23 @@ SHint shInvertMatrix(SHMatrix3x3 * restrict m, SHMatrix3x3 * restrict mout)
    return 1;
 }
 
+/*--------------------------------------------------------
+ * Returns the largest factor by which the linear part of
+ * an affine matrix stretches a vector, i.e. its largest
+ * singular value.
+ *--------------------------------------------------------*/
+
+SHfloat
+shMatrixMaxScale(SHMatrix3x3 * restrict m)
+{
+   SH_ASSERT(m != NULL);
+   SHfloat a = m->m[0][0], b = m->m[0][1];
+   SHfloat c = m->m[1][0], d = m->m[1][1];
+   SHfloat t = (a * a + b * b + c * c + d * d) / 2;
+   SHfloat det = a * d - b * c;
+   return SH_SQRT(t + SH_SQRT(SH_MAX(t * t - det * det, 0.0f)));
+}
+
 inline SHfloat
 shVectorOrientation(SHVector2 * restrict v)
 {
@@ -292,6 +292,8 @@ void shMatrixToGL(SHMatrix3x3 * m, SHfloat mgl[16]);
 
 SHint shInvertMatrix(SHMatrix3x3 * m, SHMatrix3x3 * mout);
 
+SHfloat shMatrixMaxScale(SHMatrix3x3 * m);
+
 SHfloat shVectorOrientation(SHVector2 * v);
 
 SHint shLineLineXsection(SHVector2 * o1, SHVector2 * v1,
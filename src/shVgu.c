@@ -36,11 +36,16 @@ shAppend(VGPath path, SHint commSize, const VGubyte * comm,
    VGPathDatatype type = vgGetParameterf(path, VG_PATH_DATATYPE);
    VGfloat scale = vgGetParameterf(path, VG_PATH_SCALE);
    VGfloat bias = vgGetParameterf(path, VG_PATH_BIAS);
-   SH_ASSERT(dataSize <= 26);
+   SH_GETCONTEXT(VGU_BAD_HANDLE_ERROR);
+
+   /* Converted data goes to the frame arena, no size limit */
+   void *conv = shArenaAlloc(&context->frameArena, dataSize * sizeof(VGfloat));
+   if (conv == NULL)
+      return VGU_OUT_OF_MEMORY_ERROR;
 
    switch (type) {
    case VG_PATH_DATATYPE_S_8:{
-         SHint8 data8[26];
+         SHint8 *data8 = (SHint8 *) conv;
          for (SHint i = 0; i < dataSize; ++i)
             data8[i] = (SHint8) SH_FLOOR((data[i] - bias) / scale + 0.5f);
          vgAppendPathData(path, commSize, comm, data8);
@@ -48,7 +53,7 @@ shAppend(VGPath path, SHint commSize, const VGubyte * comm,
          break;
       }
    case VG_PATH_DATATYPE_S_16:{
-         SHint16 data16[26];
+         SHint16 *data16 = (SHint16 *) conv;
          for (SHint i = 0; i < dataSize; ++i)
             data16[i] = (SHint16) SH_FLOOR((data[i] - bias) / scale + 0.5f);
          vgAppendPathData(path, commSize, comm, data16);
@@ -56,7 +61,7 @@ shAppend(VGPath path, SHint commSize, const VGubyte * comm,
          break;
       }
    case VG_PATH_DATATYPE_S_32:{
-         SHint32 data32[26];
+         SHint32 *data32 = (SHint32 *) conv;
          for (SHint i = 0; i < dataSize; ++i)
             data32[i] = (SHint32) SH_FLOOR((data[i] - bias) / scale + 0.5f);
          vgAppendPathData(path, commSize, comm, data32);
@@ -64,7 +69,7 @@ shAppend(VGPath path, SHint commSize, const VGubyte * comm,
          break;
       }
    default:{
-         VGfloat dataF[26];
+         VGfloat *dataF = (VGfloat *) conv;
          for (SHint i = 0; i < dataSize; ++i)
             dataF[i] = (data[i] - bias) / scale;
          vgAppendPathData(path, commSize, comm, dataF);
@@ -102,8 +107,10 @@ vguPolygon(VGPath path, const VGfloat * points, VGint count, VGboolean closed)
       return VGU_ILLEGAL_ARGUMENT_ERROR;
 
    VGUErrorCode err = VGU_NO_ERROR;
+   SH_GETCONTEXT(VGU_BAD_HANDLE_ERROR);
 
-   VGubyte *comm = (VGubyte *) malloc((count + 1) * sizeof(VGubyte));
+   VGubyte *comm = (VGubyte *) shArenaAlloc(&context->frameArena,
+                                            (count + 1) * sizeof(VGubyte));
    if (comm == NULL)
       return VGU_OUT_OF_MEMORY_ERROR;
 
@@ -117,7 +124,6 @@ vguPolygon(VGPath path, const VGfloat * points, VGint count, VGboolean closed)
    else
       err = shAppend(path, count, comm, count * 2, points);
 
-   free(comm);
    return err;
 }
 
@@ -354,20 +360,13 @@ vguComputeWarpQuadToSquare(VGfloat sx0, VGfloat sy0,
    if (ret == VGU_BAD_WARP_ERROR)
       return VGU_BAD_WARP_ERROR;
 
-   SHMatrix3x3 *mat = (SHMatrix3x3 *) malloc(sizeof(SHMatrix3x3));
-
-   if (mat == NULL)
-      return VGU_OUT_OF_MEMORY_ERROR;
-
-   SHint nonsingular = shInvertMatrix(&m, mat);
+   SHMatrix3x3 mat;
+   SHint nonsingular = shInvertMatrix(&m, &mat);
 
-   if (!nonsingular) {
-      free(mat);
+   if (!nonsingular)
       return VGU_BAD_WARP_ERROR;
-   }
 
-   memcpy(matrix, mat, sizeof(SHMatrix3x3));
-   free(mat);
+   memcpy(matrix, &mat, sizeof(SHMatrix3x3));
    return VGU_NO_ERROR;
 }
 
@@ -4,6 +4,17 @@
 
 #define FSDEF 1  // Fill/stroke default is fill
 
+// Scrolling polyline of the last capacity samples
+#define STRIPLINE_PATHS 4
+typedef struct {
+	VGfloat *samples;		   // ring of the last capacity samples
+	VGint capacity;
+	VGint chunk;			   // samples per path
+	VGfloat dx;			   // x distance between samples
+	unsigned long count;		   // samples pushed
+	VGPath paths[STRIPLINE_PATHS];
+} Stripline;
+
 #define Ellipse(a,b,c,d) Ellipse_f(a,b,c,d,FSDEF)
 #define Rect(a,b,c,d) Rect_f(a,b,c,d,FSDEF)
 #define Roundrect(a,b,c,d,e,f) Rect_f(a,b,c,d,e,f,FSDEF)
@@ -26,6 +37,12 @@ extern "C" {
 	extern void Qbezier(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Polygon(VGfloat *, VGfloat *, VGint);
 	extern void Polyline(VGfloat *, VGfloat *, VGint);
+	extern void PolylineDecimated(VGfloat *, VGfloat *, VGint);
+	extern void PolylineDecimatedReset(void);
+	extern Stripline StriplineInit(VGint, VGfloat);
+	extern void StriplineFree(Stripline *);
+	extern void StriplinePush(Stripline *, VGfloat);
+	extern void StriplineDraw(Stripline, VGfloat, VGfloat);
 	extern void Rect_f(VGfloat, VGfloat, VGfloat, VGfloat, VGint FSflag);
 	extern void Line(VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Roundrect_f(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGint FSflag);
@@ -1,6 +1,6 @@
 # Make file for RPI version of ShivaVG library
 
-FILES = shGLESinit.o shArrays.o shContext.o shGeometry.o shImage.o shMath.o\
+FILES = shGLESinit.o shArrays.o shArena.o shContext.o shGeometry.o shImage.o shMath.o\
         shPath.o shPaint.o shPipeline.o shVectors.o shParams.o\
         shCommons.o shVgu.o libshapes.o
 CFLAGS = -c -Werror -fmax-errors=2